@@ -4,10 +4,15 @@
  * 
  * 一个计算迷宫墙不同情况下的贴图索引的函数
  * 
- * Edited on 2025.04.15 by RZIN
+ * Edited on 2026.10.19 by RZIN
  */
 #pragma once
+#include <algorithm>
 #include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "tools/matrix.hpp"
 namespace cha
 {
 
@@ -21,6 +26,29 @@ concept PosToBool = requires(T func)
 
 
 
+/// @brief 8 邻域掩码到贴图索引的对照表
+/// @details 掩码从高位到低位依次为左上、上、右上、左、右、左下、下、右下是否为墙
+inline constexpr int MAZE_TILE_ID[256]{
+    36, 36,  0,  0, 36, 36,  0,  0, 37, 37,  1,  8, 37, 37,  1,  8,
+    39, 39,  3,  3, 39, 39, 11, 11, 38, 38,  2,  5, 38, 38,  6, 10,
+    36, 36,  0,  0, 36, 36,  0,  0, 37, 37,  1,  8, 37, 37,  1,  8,
+    39, 39,  3,  3, 39, 39, 11, 11, 38, 38,  2,  5, 38, 38,  6, 10,
+    24, 24, 12, 12, 24, 24, 12, 12, 25, 25, 13, 16, 25, 25, 13, 16,
+    27, 27, 15, 15, 27, 27, 19, 19, 26, 26, 14, 43, 26, 26, 40,  9,
+    24, 24, 12, 12, 24, 24, 12, 12, 44, 44, 28, 20, 44, 44, 28, 20,
+    27, 27, 15, 15, 27, 27, 19, 19, 41, 41,  7, 32, 41, 41, 21, 17,
+    36, 36,  0,  0, 36, 36,  0,  0, 37, 37,  1,  8, 37, 37,  1,  8,
+    39, 39,  3,  3, 39, 39, 11, 11, 38, 38,  2,  5, 38, 38,  6, 10,
+    36, 36,  0,  0, 36, 36,  0,  0, 37, 37,  1,  8, 37, 37,  1,  8,
+    39, 39,  3,  3, 39, 39, 11, 11, 38, 38,  2,  5, 38, 38,  6, 10,
+    24, 24, 12, 12, 24, 24, 12, 12, 25, 25, 13, 16, 25, 25, 13, 16,
+    47, 47, 31, 31, 47, 47, 35, 35, 42, 42,  4, 34, 42, 42, 23, 18,
+    24, 24, 12, 12, 24, 24, 12, 12, 44, 44, 28, 20, 44, 44, 28, 20,
+    47, 47, 31, 31, 47, 47, 35, 35, 45, 45, 46, 29, 45, 45, 30, 33
+};
+
+
+
 /// @brief 计算迷宫墙不同情况下的贴图索引
 /// @param y 当前坐标 y
 /// @param x 当前坐标 x
@@ -29,25 +57,7 @@ concept PosToBool = requires(T func)
 template <PosToBool Func>
 [[nodiscard]] inline int maze_tile(int y, int x, Func isw)
 {
-    constexpr int id[]{
-        36, 36,  0,  0, 36, 36,  0,  0, 37, 37,  1,  8, 37, 37,  1,  8,
-        39, 39,  3,  3, 39, 39, 11, 11, 38, 38,  2,  5, 38, 38,  6, 10,
-        36, 36,  0,  0, 36, 36,  0,  0, 37, 37,  1,  8, 37, 37,  1,  8,
-        39, 39,  3,  3, 39, 39, 11, 11, 38, 38,  2,  5, 38, 38,  6, 10,
-        24, 24, 12, 12, 24, 24, 12, 12, 25, 25, 13, 16, 25, 25, 13, 16,
-        27, 27, 15, 15, 27, 27, 19, 19, 26, 26, 14, 43, 26, 26, 40,  9,
-        24, 24, 12, 12, 24, 24, 12, 12, 44, 44, 28, 20, 44, 44, 28, 20,
-        27, 27, 15, 15, 27, 27, 19, 19, 41, 41,  7, 32, 41, 41, 21, 17,
-        36, 36,  0,  0, 36, 36,  0,  0, 37, 37,  1,  8, 37, 37,  1,  8,
-        39, 39,  3,  3, 39, 39, 11, 11, 38, 38,  2,  5, 38, 38,  6, 10,
-        36, 36,  0,  0, 36, 36,  0,  0, 37, 37,  1,  8, 37, 37,  1,  8,
-        39, 39,  3,  3, 39, 39, 11, 11, 38, 38,  2,  5, 38, 38,  6, 10,
-        24, 24, 12, 12, 24, 24, 12, 12, 25, 25, 13, 16, 25, 25, 13, 16,
-        47, 47, 31, 31, 47, 47, 35, 35, 42, 42,  4, 34, 42, 42, 23, 18,
-        24, 24, 12, 12, 24, 24, 12, 12, 44, 44, 28, 20, 44, 44, 28, 20,
-        47, 47, 31, 31, 47, 47, 35, 35, 45, 45, 46, 29, 45, 45, 30, 33
-    };
-    return id[
+    return MAZE_TILE_ID[
         isw(y - 1, x - 1) << 7 |
         isw(y - 1, x    ) << 6 |
         isw(y - 1, x + 1) << 5 |
@@ -61,33 +71,101 @@ template <PosToBool Func>
 
 
 
+/// @brief 计算整张地图的贴图索引
+/// @param h 地图行数
+/// @param w 地图列数
+/// @param isw 墙的判断函数，每个格子只调用一次，地图以外视为非墙
+/// @param out 输出，按 `Renderer::load` 的格式写入 `out[x + y * w]`
+/// @param floor 非墙格子的贴图索引
+/// @details 每行读入两侧各补一格的 0/1 字节行，三行滚动；
+///          每次把 8 个格子的字节装入一个 64 位整数，8 个方向错位后移位、按位或，一次求出 8 个格子的掩码，
+///          因为每个字节只有 0 或 1，移位不会越过字节的边界；最后逐格查表
+template <PosToBool Func>
+inline void maze_tile_bulk(int h, int w, Func isw, int* out, int floor = 22)
+{
+    if (h <= 0 || w <= 0) {
+        return;
+    }
+    // 行宽补齐到 8 的倍数，末尾一组读取越界的部分落在补齐的 0 上
+    const std::size_t words = (std::size_t(w) + 7) / 8;
+    const std::size_t stride = words * 8 + 8;
+    std::vector<std::uint8_t> buf(3 * stride, 0);
+    std::vector<std::uint8_t> mask(words * 8);
+    std::uint8_t* up = buf.data();
+    std::uint8_t* cur = up + stride;
+    std::uint8_t* down = cur + stride;
+
+    auto load = [&](int y, std::uint8_t* row) {
+        if (y >= h) {
+            std::fill(row, row + stride, std::uint8_t(0));
+            return;
+        }
+        for (int x = 0; x < w; ++x) {
+            row[x + 1] = isw(y, x) ? 1 : 0;
+        }
+    };
+    auto word = [](const std::uint8_t* p) {
+        std::uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    };
+
+    load(0, cur);
+    for (int y = 0; y < h; ++y) {
+        load(y + 1, down);
+        for (std::size_t i = 0; i < words * 8; i += 8) {
+            const std::uint64_t m =
+                word(up + i)   << 7 | word(up + i + 1)   << 6 | word(up + i + 2)   << 5 |
+                word(cur + i)  << 4 |                           word(cur + i + 2)  << 3 |
+                word(down + i) << 2 | word(down + i + 1) << 1 | word(down + i + 2);
+            std::memcpy(mask.data() + i, &m, sizeof(m));
+        }
+        int* row = out + std::size_t(y) * w;
+        for (int x = 0; x < w; ++x) {
+            const int id = MAZE_TILE_ID[mask[x]];
+            row[x] = cur[x + 1] ? id : floor;
+        }
+        std::uint8_t* tmp = up;
+        up = cur;
+        cur = down;
+        down = tmp;
+    }
+}
+
+
+
+/// @brief 计算整张地图的贴图索引，非零（非默认值）的元素为墙
+template <typename T>
+inline void maze_tile_bulk(const Matrix<T>& mat, int* out, int floor = 22)
+{
+    maze_tile_bulk(static_cast<int>(mat.rows()), static_cast<int>(mat.cols()),
+                   [&mat](int y, int x) { return mat(y, x) != T{}; }, out, floor);
+}
+
+
+
 /*
  * example
  */
 [[maybe_unused]] inline void output(char* out, bool* mat, int h, int w)
 {
-    extern int sprintf(char* out, const char* fmt, ...);
-
     constexpr const char* wall[48] {
         "┃ ", "┏━", "┳━", "┓ ", "╋━", "┳━", "┳━", "╋━", "┏━", "┻━", "━━", "┓ ",
         "┃ ", "┣━", "╋━", "┫ ", "┣━", "┛ ", "┗━", "┫ ", "┃ ", "╋━", "  ", "┣━",
         "┃ ", "┗━", "┻━", "┛ ", "┣━", "┓ ", "┏━", "┫ ", "┫ ", "█▋", "╋━", "┃ ",
         "█▋", "━━", "━━", "━ ", "╋━", "┻━", "┻━", "╋━", "┗━", "━━", "┳━", "┛ "
     };
-    auto is_wall = [mat, h, w](int y, int x) {
-        return (y | x | h - y - 1 | w - x - 1) >= 0 && mat[y * w + x];
-    };
 
-    int pos = 0;
-    for (int i{}; i < h; ++i) {
-        for (int j{}; j < w; ++j) {
-            if (is_wall(i, j)) {
-                pos += sprintf(out + pos, "%s", wall[maze_tile(i, j, is_wall)]);
-            } else {
-                pos += sprintf(out + pos, "%s", wall[22]);
-            }
-        }
+    std::vector<int> ids(std::size_t(h) * w);
+    maze_tile_bulk(h, w, [mat, w](int y, int x) { return mat[y * w + x]; }, ids.data(), 22);
+
+    std::size_t pos = 0;
+    for (const int id : ids) {
+        const std::size_t len = std::strlen(wall[id]);
+        std::memcpy(out + pos, wall[id], len);
+        pos += len;
     }
+    out[pos] = '\0';
 }
 
 
@@ -0,0 +1,69 @@
+/*
+ * alloc_counter.hpp
+ * Created on 2026.10.19 by RZIN
+ * Edited on 2026.10.19 by RZIN
+ */
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+namespace cha
+{
+
+
+
+/// @brief 统计当前线程的堆分配次数，用于检查求解循环中不再分配内存
+/// @details 计数依赖替换全局的 `operator new`：在且仅在一个翻译单元中
+///          先定义 `CHA_ALLOC_COUNTER` 再包含本文件；未替换时计数始终为 0。
+///          构造时记录当前的计数，`get()` 返回此后的分配次数。
+class AllocCounter
+{
+private:
+    std::size_t start_;
+
+public:
+    AllocCounter() noexcept
+        : start_(total()) {}
+
+    std::size_t get() const noexcept {
+        return total() - start_;
+    }
+
+    static std::size_t& total() noexcept {
+        thread_local std::size_t count = 0;
+        return count;
+    }
+};
+
+
+
+} // namespace cha
+
+
+
+#ifdef CHA_ALLOC_COUNTER
+
+void* operator new(std::size_t size)
+{
+    ++cha::AllocCounter::total();
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+#endif
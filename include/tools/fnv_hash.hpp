@@ -0,0 +1,52 @@
+/*
+ * fnv_hash.hpp
+ * Created on 2026.10.19 by RZIN
+ * Edited on 2026.10.19 by RZIN
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <type_traits>
+namespace cha
+{
+
+
+
+/// @brief 64 位 FNV-1a 哈希，结果只取决于输入的字节，可以写入文件跨进程使用
+/// @note 按值的内存表示计算，跨字节序的机器之间不一致
+class FnvHash
+{
+private:
+    std::uint64_t state_ = 0xcbf29ce484222325ull;
+
+public:
+    constexpr FnvHash& addBytes(const void* data, std::size_t size) noexcept {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        for (std::size_t i = 0; i < size; ++i) {
+            state_ = (state_ ^ bytes[i]) * 0x100000001b3ull;
+        }
+        return *this;
+    }
+
+    template <typename T>
+        requires std::is_trivially_copyable_v<T>
+    FnvHash& add(const T& value) noexcept {
+        return addBytes(&value, sizeof(T));
+    }
+
+    template <typename T>
+        requires std::is_trivially_copyable_v<T>
+    FnvHash& add(std::span<const T> values) noexcept {
+        add(values.size());
+        return addBytes(values.data(), values.size_bytes());
+    }
+
+    constexpr std::uint64_t value() const noexcept {
+        return state_;
+    }
+};
+
+
+
+} // namespace cha
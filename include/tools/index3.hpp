@@ -0,0 +1,238 @@
+/*
+ * index3.hpp
+ * Created on 2026.10.19 by RZIN
+ * Edited on 2026.10.19 by RZIN
+ */
+#pragma once
+#include <cstddef>
+#include <functional>
+#include "index2.hpp"
+namespace cha
+{
+
+
+
+template <typename T>
+struct Template_Index3
+{
+    T z{};
+    T y{};
+    T x{};
+
+    constexpr Template_Index3() noexcept = default;
+    constexpr Template_Index3(const Template_Index3& other) noexcept = default;
+    constexpr Template_Index3& operator=(const Template_Index3& other) noexcept = default;
+
+    constexpr Template_Index3(T z, T y, T x) noexcept : z(z), y(y), x(x) {}
+    constexpr explicit Template_Index3(T idx) noexcept : z(idx), y(idx), x(idx) {}
+
+    /// @brief 由二维下标构造，z 取 0
+    constexpr Template_Index3(const Template_Index2<T>& index) noexcept : z(0), y(index.y), x(index.x) {}
+
+    [[nodiscard]] static constexpr Template_Index3 fromIndex(T idx, T height, T width) {
+        return {idx / (height * width), idx / width % height, idx % width};
+    }
+
+    [[nodiscard]] constexpr T toIndex(T height, T width) const noexcept {
+        return (z * height + y) * width + x;
+    }
+
+    /// @brief 丢弃 z 分量
+    [[nodiscard]] constexpr Template_Index2<T> yx() const noexcept {
+        return {y, x};
+    }
+
+    [[nodiscard]] constexpr T operator*() const noexcept {
+        return x * y * z;
+    }
+
+    [[nodiscard]] constexpr Template_Index3 operator-() const noexcept {
+        return {-z, -y, -x};
+    }
+
+    [[nodiscard]] constexpr Template_Index3 operator+(const Template_Index3& other) const noexcept {
+        return {z + other.z, y + other.y, x + other.x};
+    }
+
+    [[nodiscard]] constexpr Template_Index3 operator-(const Template_Index3& other) const noexcept {
+        return {z - other.z, y - other.y, x - other.x};
+    }
+
+    [[nodiscard]] constexpr Template_Index3 operator*(const Template_Index3& other) const noexcept {
+        return {z * other.z, y * other.y, x * other.x};
+    }
+
+    [[nodiscard]] constexpr Template_Index3 operator/(const Template_Index3& other) const {
+        return {z / other.z, y / other.y, x / other.x};
+    }
+
+    [[nodiscard]] constexpr Template_Index3 operator*(T scalar) const noexcept {
+        return {z * scalar, y * scalar, x * scalar};
+    }
+
+    [[nodiscard]] constexpr Template_Index3 operator/(T scalar) const {
+        return {z / scalar, y / scalar, x / scalar};
+    }
+
+    constexpr Template_Index3& operator+=(const Template_Index3& other) noexcept {
+        z += other.z;
+        y += other.y;
+        x += other.x;
+        return *this;
+    }
+
+    constexpr Template_Index3& operator-=(const Template_Index3& other) noexcept {
+        z -= other.z;
+        y -= other.y;
+        x -= other.x;
+        return *this;
+    }
+
+    [[nodiscard]] constexpr bool operator==(const Template_Index3& other) const noexcept {
+        return z == other.z && y == other.y && x == other.x;
+    }
+
+    [[nodiscard]] constexpr bool operator!=(const Template_Index3& other) const noexcept {
+        return !(*this == other);
+    }
+
+    [[nodiscard]] constexpr bool operator<(const Template_Index3& other) const noexcept {
+        return z != other.z ? z < other.z : y != other.y ? y < other.y : x < other.x;
+    }
+
+    [[nodiscard]] constexpr bool strictLess(const Template_Index3& other) const noexcept {
+        return (z < other.z) & (y < other.y) & (x < other.x);
+    }
+
+    [[nodiscard]] constexpr bool strictLessEqual(const Template_Index3& other) const noexcept {
+        return (z <= other.z) & (y <= other.y) & (x <= other.x);
+    }
+
+    struct Range
+    {
+        Template_Index3 tl;
+        Template_Index3 br;
+
+        constexpr Range(const Range& other) noexcept = default;
+        constexpr Range& operator=(const Range& other) noexcept = default;
+        constexpr Range(const Template_Index3& begin, const Template_Index3& end) noexcept : tl(begin), br(end) {}
+        constexpr explicit Range(const Template_Index3& end) noexcept : tl(0), br(end) {}
+
+        [[nodiscard]] constexpr bool contains(const Template_Index3& index) const noexcept {
+            return tl.strictLessEqual(index) & index.strictLess(br);
+        }
+
+        [[nodiscard]] constexpr bool operator==(const Range& other) const noexcept {
+            return tl == other.tl && br == other.br;
+        }
+
+        [[nodiscard]] constexpr bool operator!=(const Range& other) const noexcept {
+            return !(*this == other);
+        }
+
+        struct Iterator
+        {
+            using value_type = Template_Index3;
+
+            Range range;
+            Template_Index3 index;
+
+            constexpr Iterator() noexcept : range({}) {}
+            constexpr explicit Iterator(Range range) noexcept : range(range), index(range.tl) {}
+
+            constexpr Iterator& operator++() noexcept {
+                ++index.x;
+                if (index.x == range.br.x) {
+                    index.x = range.tl.x;
+                    ++index.y;
+                    if (index.y == range.br.y) {
+                        index.y = range.tl.y;
+                        ++index.z;
+                    }
+                }
+                return *this;
+            }
+
+            constexpr Iterator operator++(int) noexcept {
+                Iterator temp = *this;
+                ++*this;
+                return temp;
+            }
+
+            [[nodiscard]] constexpr value_type operator*() const noexcept {
+                return index;
+            }
+
+            [[nodiscard]] constexpr bool operator==([[maybe_unused]] const Iterator& other) const noexcept {
+                return index.z >= range.br.z;
+            }
+
+            [[nodiscard]] constexpr bool operator!=(const Iterator& other) const noexcept {
+                return !(*this == other);
+            }
+        };
+
+        [[nodiscard]] constexpr Iterator begin() const noexcept {
+            return Iterator(*this);
+        }
+
+        [[nodiscard]] constexpr Iterator end() const noexcept {
+            return Iterator();
+        }
+    };
+};
+
+
+
+template <typename T>
+[[nodiscard]] inline constexpr Template_Index3<T> operator*(T scalar, const Template_Index3<T> index) noexcept {
+    return index * scalar;
+}
+
+
+
+using Int3 = Template_Index3<int>;
+
+
+
+/// @brief 六邻域（面相邻），第 d 个方向的反方向为第 5 - d 个
+/// @note 其中 1 ~ 4 与 DIR4 顺序一致
+inline constexpr Int3 DIR6[6] = {
+    {-1, 0, 0},
+    { 0,-1, 0}, { 0, 0,-1}, { 0, 0, 1}, { 0, 1, 0},
+    { 1, 0, 0}
+};
+
+
+
+/// @brief 二十六邻域（面、棱、角相邻），第 d 个方向的反方向为第 25 - d 个
+inline constexpr Int3 DIR26[26] = {
+    {-1,-1,-1}, {-1,-1, 0}, {-1,-1, 1},
+    {-1, 0,-1}, {-1, 0, 0}, {-1, 0, 1},
+    {-1, 1,-1}, {-1, 1, 0}, {-1, 1, 1},
+
+    { 0,-1,-1}, { 0,-1, 0}, { 0,-1, 1},
+    { 0, 0,-1},             { 0, 0, 1},
+    { 0, 1,-1}, { 0, 1, 0}, { 0, 1, 1},
+
+    { 1,-1,-1}, { 1,-1, 0}, { 1,-1, 1},
+    { 1, 0,-1}, { 1, 0, 0}, { 1, 0, 1},
+    { 1, 1,-1}, { 1, 1, 0}, { 1, 1, 1}
+};
+
+
+
+} // namespace cha
+
+
+
+namespace std
+{
+    template <typename T>
+    struct hash<cha::Template_Index3<T>>
+    {
+        [[nodiscard]] size_t operator()(const cha::Template_Index3<T>& index) const noexcept {
+            return hash<T>()(index.z) ^ hash<T>()(index.y) << 1 ^ hash<T>()(index.x) << 2;
+        }
+    };
+}
@@ -0,0 +1,359 @@
+/*
+ * mapped_matrix.hpp
+ * Created on 2026.10.19 by RZIN
+ * Edited on 2026.10.19 by RZIN
+ */
+#pragma once
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include "index2.hpp"
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+namespace cha
+{
+
+
+
+/// @brief 以内存映射文件为存储的二维数组类模板，用于超出内存的大地图
+/// @details 元素按 `TILE x TILE` 的块排列，每块恰好占一页（4 KiB），块之间按行优先排列，
+///          因此二维的局部访问只涉及少数几页，整行写入时也只连续推进 `TILE` 行高的一条带。
+///          文件开头一页为 `Header`，之后即为元素，文件本身就是保存的结果，下游可以直接映射读取。
+///          映射由操作系统按需换入换出，`advise` / `release` / `prefetch` 按访问模式给出提示。
+///          文件无法创建、格式不符或映射失败时 `isOpen()` 为 false
+/// @tparam T 可平凡复制的元素类型
+template <typename T>
+class MappedMatrix
+{
+    static_assert(std::is_trivially_copyable_v<T>, "MappedMatrix requires a trivially copyable type");
+
+public:
+    /// @brief 页的大小，也是文件头所占的字节数
+    static constexpr std::size_t PAGE = 4096;
+
+    /// @brief 块的边长：使一块不超过一页的最大的 2 的幂
+    static constexpr std::size_t TILE = [] {
+        std::size_t side = 1;
+        while ((side * 2) * (side * 2) * sizeof(T) <= PAGE) side *= 2;
+        return side;
+    }();
+
+    /// @brief 文件头，所有字段为小端序
+    struct Header
+    {
+        char magic[8];              // "CHAMTX01"
+        std::uint32_t element;      // 元素的字节数
+        std::uint32_t tile;         // 块的边长
+        std::uint64_t rows;
+        std::uint64_t cols;
+    };
+
+    /// @brief 访问模式
+    enum class Access
+    {
+        Normal,     // 默认的预读
+        Sequential, // 按行顺序读写，例如扫描线求解与流式生成
+        Random      // 随机访问，关闭预读
+    };
+
+private:
+    static constexpr char MAGIC[8] = {'C', 'H', 'A', 'M', 'T', 'X', '0', '1'};
+    static constexpr std::size_t SHIFT = std::countr_zero(TILE);
+
+    std::uint8_t* base_ = nullptr;
+    std::size_t bytes_ = 0;
+    std::size_t rows_ = 0;
+    std::size_t cols_ = 0;
+    std::size_t tiles_x_ = 0;
+    bool writable_ = false;
+
+public:
+    MappedMatrix() = default;
+
+    /// @brief 创建文件，已经存在时覆盖
+    /// @param rows 数组行数
+    /// @param cols 数组列数
+    /// @param init_val 元素初始值，为全零时不需要写入（文件以稀疏方式扩展）
+    MappedMatrix(const std::string& path, std::size_t rows, std::size_t cols, const T& init_val = T{}) {
+        const std::size_t bytes = PAGE + bytesOf_(rows, cols);
+        if (!map_(path, bytes, true, true)) return;
+        Header header{};
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.element = sizeof(T);
+        header.tile = TILE;
+        header.rows = rows;
+        header.cols = cols;
+        std::memcpy(base_, &header, sizeof(header));
+        setShape_(rows, cols);
+        const T zero{};
+        if (std::memcmp(&init_val, &zero, sizeof(T)) != 0) fill(init_val);
+    }
+
+    /// @brief 打开已有的文件
+    /// @param writable 是否以可写方式映射
+    explicit MappedMatrix(const std::string& path, bool writable = false) {
+        if (!map_(path, 0, false, writable)) return;
+        Header header;
+        std::memcpy(&header, base_, sizeof(header));
+        if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.element != sizeof(T) || header.tile != TILE
+            || bytes_ < PAGE + bytesOf_(std::size_t(header.rows), std::size_t(header.cols))) {
+            unmap();
+            return;
+        }
+        setShape_(std::size_t(header.rows), std::size_t(header.cols));
+    }
+
+    MappedMatrix(const MappedMatrix&) = delete;
+    MappedMatrix& operator=(const MappedMatrix&) = delete;
+
+    MappedMatrix(MappedMatrix&& other) noexcept
+        : base_(std::exchange(other.base_, nullptr)), bytes_(std::exchange(other.bytes_, 0)),
+          rows_(std::exchange(other.rows_, 0)), cols_(std::exchange(other.cols_, 0)),
+          tiles_x_(std::exchange(other.tiles_x_, 0)), writable_(std::exchange(other.writable_, false)) {}
+
+    MappedMatrix& operator=(MappedMatrix&& other) noexcept {
+        if (this != &other) {
+            unmap();
+            base_ = std::exchange(other.base_, nullptr);
+            bytes_ = std::exchange(other.bytes_, 0);
+            rows_ = std::exchange(other.rows_, 0);
+            cols_ = std::exchange(other.cols_, 0);
+            tiles_x_ = std::exchange(other.tiles_x_, 0);
+            writable_ = std::exchange(other.writable_, false);
+        }
+        return *this;
+    }
+
+    ~MappedMatrix() {
+        unmap();
+    }
+
+    bool isOpen() const noexcept {
+        return base_ != nullptr;
+    }
+
+    bool isWritable() const noexcept {
+        return writable_;
+    }
+
+    /// @brief 元素 (row, col) 在元素区中的下标
+    std::size_t index(std::size_t row, std::size_t col) const noexcept {
+        const std::size_t tile = (row >> SHIFT) * tiles_x_ + (col >> SHIFT);
+        return (tile << (2 * SHIFT)) | ((row & (TILE - 1)) << SHIFT) | (col & (TILE - 1));
+    }
+
+    T& operator()(std::size_t row, std::size_t col) noexcept {
+        return data()[index(row, col)];
+    }
+
+    const T& operator()(std::size_t row, std::size_t col) const noexcept {
+        return data()[index(row, col)];
+    }
+
+    T& operator[](Int2 idx) noexcept {
+        return data()[index(idx.y, idx.x)];
+    }
+
+    const T& operator[](Int2 idx) const noexcept {
+        return data()[index(idx.y, idx.x)];
+    }
+
+    T& at(std::size_t row, std::size_t col) {
+        check_bounds(row, col);
+        return data()[index(row, col)];
+    }
+
+    const T& at(std::size_t row, std::size_t col) const {
+        check_bounds(row, col);
+        return data()[index(row, col)];
+    }
+
+    T& at(Int2 idx) {
+        check_bounds(idx.y, idx.x);
+        return data()[index(idx.y, idx.x)];
+    }
+
+    const T& at(Int2 idx) const {
+        check_bounds(idx.y, idx.x);
+        return data()[index(idx.y, idx.x)];
+    }
+
+    /// @brief 填充数组（包括块中超出边界的部分）
+    void fill(const T& value) {
+        T* ptr = data();
+        const std::size_t count = bytesOf_(rows_, cols_) / sizeof(T);
+        for (std::size_t i = 0; i < count; ++i) {
+            ptr[i] = value;
+        }
+    }
+
+    std::size_t rows() const noexcept { return rows_; }
+
+    std::size_t cols() const noexcept { return cols_; }
+
+    std::pair<std::size_t, std::size_t> size() const noexcept { return std::make_pair(rows_, cols_); }
+
+    std::size_t length() const noexcept { return rows_ * cols_; }
+
+    bool empty() const noexcept { return rows_ == 0 || cols_ == 0; }
+
+    /// @brief 元素区的起始地址，元素按块排列，位置由 `index()` 给出
+    T* data() noexcept { return reinterpret_cast<T*>(base_ + PAGE); }
+
+    const T* data() const noexcept { return reinterpret_cast<const T*>(base_ + PAGE); }
+
+    /// @brief 按访问模式设置整个映射的预读策略
+    void advise(Access access) noexcept {
+#ifndef _WIN32
+        if (!base_) return;
+        const int advice = access == Access::Sequential ? MADV_SEQUENTIAL : access == Access::Random ? MADV_RANDOM : MADV_NORMAL;
+        ::madvise(base_, bytes_, advice);
+#else
+        (void)access;
+#endif
+    }
+
+    /// @brief 提示即将访问 [first, last) 行
+    void prefetch(std::size_t first, std::size_t last) noexcept {
+#ifndef _WIN32
+        const auto [begin, end] = band_(first, last, false);
+        if (begin < end) ::madvise(base_ + begin, end - begin, MADV_WILLNEED);
+#else
+        (void)first;
+        (void)last;
+#endif
+    }
+
+    /// @brief 不再访问 [first, last) 行：开始写回已修改的页并从进程中释放，只处理完全位于其中的块
+    /// @details 顺序生成时每写完一条带调用一次，常驻内存即只有正在写入的几条带，与地图大小无关
+    void release(std::size_t first, std::size_t last) noexcept {
+        const auto [begin, end] = band_(first, last, true);
+        if (begin >= end) return;
+#ifdef _WIN32
+        if (writable_) FlushViewOfFile(base_ + begin, end - begin);
+#else
+        if (writable_) ::msync(base_ + begin, end - begin, MS_ASYNC);
+        ::madvise(base_ + begin, end - begin, MADV_DONTNEED);
+#endif
+    }
+
+    /// @brief 把所有修改写回文件，返回是否成功
+    bool flush() noexcept {
+        if (!base_ || !writable_) return base_ != nullptr;
+#ifdef _WIN32
+        return FlushViewOfFile(base_, 0) != 0;
+#else
+        return ::msync(base_, bytes_, MS_SYNC) == 0;
+#endif
+    }
+
+private:
+    static std::size_t bytesOf_(std::size_t rows, std::size_t cols) noexcept {
+        const std::size_t tiles = ((rows + TILE - 1) >> SHIFT) * ((cols + TILE - 1) >> SHIFT);
+        return tiles * TILE * TILE * sizeof(T);
+    }
+
+    void setShape_(std::size_t rows, std::size_t cols) noexcept {
+        rows_ = rows;
+        cols_ = cols;
+        tiles_x_ = (cols + TILE - 1) >> SHIFT;
+    }
+
+    /*
+     * [first, last) 行所在的块带在文件中的字节范围，按页对齐
+     * inner 为真时只取完全位于其中的带，否则取与之相交的带
+     */
+    std::pair<std::size_t, std::size_t> band_(std::size_t first, std::size_t last, bool inner) const noexcept {
+        if (!base_ || first >= last) return {0, 0};
+        last = last < rows_ ? last : rows_;
+        const std::size_t band = tiles_x_ * TILE * TILE * sizeof(T);
+        std::size_t lo = inner ? (first + TILE - 1) >> SHIFT : first >> SHIFT;
+        std::size_t hi = inner && last != rows_ ? last >> SHIFT : (last + TILE - 1) >> SHIFT;
+        if (lo >= hi) return {0, 0};
+        return {PAGE + lo * band, PAGE + hi * band};
+    }
+
+    /*
+     * 映射整个文件；create 为真时新建（截断）文件并扩展到 bytes 字节
+     */
+    bool map_(const std::string& path, std::size_t bytes, bool create, bool writable) noexcept {
+#ifdef _WIN32
+        const DWORD access = writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ;
+        const HANDLE file = CreateFileA(path.c_str(), access, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                        nullptr, create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        if (!create) {
+            LARGE_INTEGER size;
+            if (GetFileSizeEx(file, &size)) bytes = static_cast<std::size_t>(size.QuadPart);
+        }
+        if (bytes >= PAGE) {
+            const std::uint64_t size = bytes;
+            if (const HANDLE mapping = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                                          DWORD(size >> 32), DWORD(size), nullptr)) {
+                base_ = static_cast<std::uint8_t*>(MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0));
+                CloseHandle(mapping);
+            }
+        }
+        CloseHandle(file);
+#else
+        const int fd = ::open(path.c_str(), create ? O_RDWR | O_CREAT | O_TRUNC : writable ? O_RDWR : O_RDONLY, 0644);
+        if (fd < 0) return false;
+        struct stat st;
+        if (create) {
+            if (::ftruncate(fd, off_t(bytes)) != 0) bytes = 0;
+        } else {
+            bytes = ::fstat(fd, &st) == 0 ? std::size_t(st.st_size) : 0;
+        }
+        if (bytes >= PAGE) {
+            void* ptr = ::mmap(nullptr, bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+            if (ptr != MAP_FAILED) base_ = static_cast<std::uint8_t*>(ptr);
+        }
+        ::close(fd);
+#endif
+        if (!base_) return false;
+        bytes_ = bytes;
+        writable_ = writable;
+        return true;
+    }
+
+    void unmap() noexcept {
+        if (!base_) return;
+#ifdef _WIN32
+        UnmapViewOfFile(base_);
+#else
+        ::munmap(base_, bytes_);
+#endif
+        base_ = nullptr;
+        bytes_ = 0;
+        rows_ = 0;
+        cols_ = 0;
+        tiles_x_ = 0;
+        writable_ = false;
+    }
+
+    void check_bounds(std::size_t row, std::size_t col) const {
+        if (row >= rows_ || col >= cols_)
+            throw std::out_of_range("MappedMatrix index out of range");
+    }
+};
+
+
+
+} // namespace cha
@@ -0,0 +1,183 @@
+/*
+ * matrix3.hpp
+ * Created on 2026.10.19 by RZIN
+ * Edited on 2026.10.19 by RZIN
+ */
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include "index3.hpp"
+namespace cha
+{
+
+
+
+/// @brief 分块存储的三维动态数组类模板
+/// @tparam T
+/// @details 固定 (z, y) 的一行元素连续存放，便于整行处理；
+///          各行再按 `TILE`×`TILE` 的 (z, y) 块排列，使 z、y 方向上的邻居落在相近的内存中。
+///          深度为 1 时退化为按行存储的二维数组。
+template <typename T>
+class Matrix3
+{
+public:
+    using value_type = T;
+    using iterator = typename std::vector<T>::iterator;
+    using const_iterator = typename std::vector<T>::const_iterator;
+    using reference = typename std::vector<T>::reference;
+    using const_reference = typename std::vector<T>::const_reference;
+    using size_type = typename std::vector<T>::size_type;
+
+    /// @brief 分块的边长（以行计）
+    static constexpr int TILE = 4;
+
+private:
+    Int3 size_{};
+    std::vector<int> row_index_;    // z * rows + y -> 存储中的行号
+    std::vector<int> row_coord_;    // 存储中的行号 -> z * rows + y
+    std::vector<T> data_;
+
+public:
+    /// @brief 默认构造函数
+    Matrix3() = default;
+
+    /// @brief 构造函数
+    /// @param depth 数组层数
+    /// @param rows 数组行数
+    /// @param cols 数组列数
+    /// @param init_val 元素初始值
+    Matrix3(std::size_t depth, std::size_t rows, std::size_t cols, const T& init_val = T{})
+        : size_(int(depth), int(rows), int(cols)), data_(depth * rows * cols, init_val) {
+        build_rows();
+    }
+
+    /// @brief 构造函数
+    /// @param size {层数, 行数, 列数}
+    /// @param init_val 元素初始值
+    explicit Matrix3(Int3 size, const T& init_val = T{})
+        : Matrix3(size.z, size.y, size.x, init_val) {}
+
+    Matrix3(const Matrix3&) = default;
+    Matrix3& operator=(const Matrix3&) = default;
+    Matrix3(Matrix3&&) noexcept = default;
+    Matrix3& operator=(Matrix3&&) noexcept = default;
+
+    /// @brief 三维下标对应的存储位置
+    [[nodiscard]] std::size_t index(Int3 idx) const noexcept {
+        return std::size_t(row_index_[idx.z * size_.y + idx.y]) * size_.x + idx.x;
+    }
+
+    /// @brief 存储位置对应的三维下标
+    [[nodiscard]] Int3 coord(std::size_t idx) const noexcept {
+        const int zy = row_coord_[idx / size_.x];
+        return {zy / size_.y, zy % size_.y, int(idx % size_.x)};
+    }
+
+    /// @brief 第 (z, y) 行的首元素指针
+    T* row(int z, int y) noexcept {
+        return data_.data() + std::size_t(row_index_[z * size_.y + y]) * size_.x;
+    }
+
+    const T* row(int z, int y) const noexcept {
+        return data_.data() + std::size_t(row_index_[z * size_.y + y]) * size_.x;
+    }
+
+    reference operator[](Int3 idx) noexcept {
+        return data_[index(idx)];
+    }
+
+    const_reference operator[](Int3 idx) const noexcept {
+        return data_[index(idx)];
+    }
+
+    reference at(Int3 idx) {
+        check_bounds(idx);
+        return data_[index(idx)];
+    }
+
+    const_reference at(Int3 idx) const {
+        check_bounds(idx);
+        return data_[index(idx)];
+    }
+
+    /// @brief 通过存储位置访问元素
+    reference operator[](std::size_t idx) noexcept {
+        return data_[idx];
+    }
+
+    const_reference operator[](std::size_t idx) const noexcept {
+        return data_[idx];
+    }
+
+    /// @brief 填充数组
+    /// @param value 填充值
+    void fill(const T& value) {
+        std::fill(data_.begin(), data_.end(), value);
+    }
+
+    /// @brief 交换两个数组
+    void swap(Matrix3& other) noexcept {
+        using std::swap;
+        swap(size_, other.size_);
+        row_index_.swap(other.row_index_);
+        row_coord_.swap(other.row_coord_);
+        data_.swap(other.data_);
+    }
+
+    /// @brief 获取数组尺寸
+    /// @return {层数, 行数, 列数}
+    Int3 size() const noexcept { return size_; }
+
+    std::size_t depth() const noexcept { return size_.z; }
+    std::size_t rows() const noexcept { return size_.y; }
+    std::size_t cols() const noexcept { return size_.x; }
+
+    /// @brief 获取数组长度
+    std::size_t length() const noexcept { return data_.size(); }
+
+    bool empty() const noexcept { return data_.empty(); }
+
+    T* data() noexcept { return data_.data(); }
+    const T* data() const noexcept { return data_.data(); }
+
+    iterator begin() noexcept { return data_.begin(); }
+    iterator end() noexcept { return data_.end(); }
+    const_iterator begin() const noexcept { return data_.begin(); }
+    const_iterator end() const noexcept { return data_.end(); }
+
+private:
+    void build_rows() {
+        row_index_.assign(std::size_t(size_.z) * size_.y, 0);
+        row_coord_.assign(row_index_.size(), 0);
+        int r = 0;
+        for (int zt = 0; zt < size_.z; zt += TILE) {
+            for (int yt = 0; yt < size_.y; yt += TILE) {
+                for (int z = zt; z < std::min(zt + TILE, size_.z); ++z) {
+                    for (int y = yt; y < std::min(yt + TILE, size_.y); ++y) {
+                        row_index_[z * size_.y + y] = r;
+                        row_coord_[r++] = z * size_.y + y;
+                    }
+                }
+            }
+        }
+    }
+
+    void check_bounds(Int3 idx) const {
+        if (!Int3::Range(size_).contains(idx))
+            throw std::out_of_range("Matrix3 index out of range");
+    }
+};
+
+
+
+/// @brief 交换两个数组
+template <typename T>
+void swap(Matrix3<T>& a, Matrix3<T>& b) noexcept {
+    a.swap(b);
+}
+
+
+
+} // namespace cha
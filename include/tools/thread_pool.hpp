@@ -0,0 +1,164 @@
+/*
+ * thread_pool.hpp
+ * Created on 2026.10.19 by RZIN
+ * Edited on 2026.10.19 by RZIN
+ */
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+namespace cha
+{
+
+
+
+/// @brief 固定数量工作线程的线程池
+class ThreadPool
+{
+private:
+    // parallelFor 的一批下标，位于调用者的栈上，空闲的工作线程加入领取下标
+    struct Batch
+    {
+        void (*call)(void*, std::size_t);
+        void* func;
+        std::size_t count;
+        std::atomic<std::size_t> next{0};
+        std::size_t active = 0;     // 正在领取下标的工作线程数量，由 mutex_ 保护
+        Batch* link = nullptr;
+
+        void run() {
+            for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+                call(func, i);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    Batch* batches_ = nullptr;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable batch_cv_;
+    bool stop_ = false;
+
+public:
+    /// @brief 构造函数
+    /// @param threads 工作线程数量，为 0 时取硬件并发数
+    explicit ThreadPool(std::size_t threads = 0) {
+        if (threads == 0) {
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        workers_.reserve(threads);
+        for (std::size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] { work(); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    std::size_t size() const noexcept {
+        return workers_.size();
+    }
+
+    /// @brief 提交一个任务
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard lock(mutex_);
+            tasks_.push(std::move(task));
+        }
+        cv_.notify_one();
+    }
+
+    /// @brief 并行执行 `func(0) ~ func(count - 1)` 并等待全部完成
+    /// @details 调用线程与空闲的工作线程从共享的计数器领取下标，调用线程在领完之后只等待已经加入的工作线程，
+    ///          因此在工作线程中调用也不会死锁（没有空闲的工作线程时由调用线程独自执行）。
+    ///          这一批下标放在调用者的栈上，不经过任务队列，不分配堆内存。
+    template <typename Func>
+    void parallelFor(std::size_t count, Func&& func) {
+        if (count == 0) return;
+        using FuncType = std::remove_reference_t<Func>;
+        Batch batch;
+        batch.call = [](void* f, std::size_t i) {
+            (*static_cast<FuncType*>(f))(i);
+        };
+        batch.func = const_cast<void*>(static_cast<const void*>(std::addressof(func)));
+        batch.count = count;
+        if (count > 1) {
+            {
+                std::lock_guard lock(mutex_);
+                batch.link = batches_;
+                batches_ = &batch;
+            }
+            cv_.notify_all();
+        }
+        batch.run();
+        if (count > 1) {
+            std::unique_lock lock(mutex_);
+            unlink(&batch);
+            batch_cv_.wait(lock, [&] { return batch.active == 0; });
+        }
+    }
+
+private:
+    // 调用者持有 mutex_
+    void unlink(Batch* batch) noexcept {
+        for (Batch** ptr = &batches_; *ptr; ptr = &(*ptr)->link) {
+            if (*ptr == batch) {
+                *ptr = batch->link;
+                return;
+            }
+        }
+    }
+
+    void work() {
+        while (true) {
+            std::function<void()> task;
+            Batch* batch = nullptr;
+            {
+                std::unique_lock lock(mutex_);
+                cv_.wait(lock, [this] { return stop_ || batches_ || !tasks_.empty(); });
+                if (batches_) {
+                    batch = batches_;
+                    ++batch->active;
+                } else {
+                    if (stop_ && tasks_.empty()) return;
+                    task = std::move(tasks_.front());
+                    tasks_.pop();
+                }
+            }
+            if (batch) {
+                batch->run();
+                // 下标已经领完，不再让其它工作线程加入；最后一个离开的通知调用者
+                std::lock_guard lock(mutex_);
+                unlink(batch);
+                if (--batch->active == 0) batch_cv_.notify_all();
+                continue;
+            }
+            task();
+        }
+    }
+};
+
+
+
+} // namespace cha
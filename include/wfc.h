@@ -1,22 +1,33 @@
 #pragma once
 #include <bit>
+#include <chrono>
 #include <concepts>
 #include <cstdint>
 #include <initializer_list>
 #include <vector>
-#include <map>
-#include <unordered_set>
 #include <random>
 #include <functional>
 #include <iterator>
+#include <span>
+#include <type_traits>
+#include <variant>
 #include "tools/index2.hpp"
+#include "tools/index3.hpp"
 #include "tools/matrix.hpp"
+#include "tools/matrix3.hpp"
 #include "tools/generator.hpp"
+#include "wfc_rule.hpp"
+#include "wfc_topology.h"
 namespace cha
 {
 
 
 
+class GlobalConstraints;
+class ThreadPool;
+
+
+
 class WaveFunctionCollapse
 {
 private:
@@ -26,39 +37,324 @@ public:
     using FactorType = int;
     using BitsetType = uint32_t;
     using WeightType = int;
-    using DiffuseFuncType = std::function<BitsetType(BitsetType bitset, Int2 displacement)>;
+    using DiffuseFuncType = std::function<BitsetType(BitsetType bitset, Int3 displacement)>;
+
+    /// @brief 约束传播方式
+    /// @details `Queue` 从被修改的格子出发逐层扩散，适合稀疏的传播
+    ///          `Sweep` 以整行为单位反复扫描直到不动点，适合大量预设或稠密的传播
+    ///          `Parallel` 与 `Queue` 相同，但较大的一层按位置分块交给线程池并行处理，结果与 `Queue` 相同；
+    ///          需要先 `setThreadPool`，只对邻接兼容表规则生效
+    enum class Propagation
+    {
+        Queue, Sweep, Parallel
+    };
+
+    /// @brief 选择下一个待决定格子的策略
+    /// @details `Entropy` 选择香农熵最小的格子，每次扫描所有格子
+    ///          `MRV` 选择可能性最少的格子，按可能性数量分桶
+    ///          `Scanline` 按存储顺序（二维时即逐行）选择
+    ///          `Hilbert` 按希尔伯特曲线的顺序选择，三维时逐层
+    ///          `Spiral` 从预设（与 `init()` 之后的初始状态不同）的格子出发，按广度优先的顺序向外选择，没有预设时从中心出发
+    ///          除 `Entropy` 外每次选择的均摊代价为 O(1)
+    enum class Heuristic
+    {
+        Entropy, MRV, Scanline, Hilbert, Spiral
+    };
+
+    /// @brief 分步求解的状态
+    /// @details `Idle` 尚未开始，下一次 `step()` 时建立搜索栈；`Running` 求解中；
+    ///          `Done` 所有格子均已决定；`Failed` 所有选择都已尝试，无解；`OverBudget` 内存超出预算而停止
+    enum class Status
+    {
+        Idle, Running, Done, Failed, OverBudget
+    };
+
+    /// @brief 内存超出预算时的处理方式
+    /// @details `Fail` 停止求解，状态为 `OverBudget`；`Restart` 撤销所有决定、释放撤销记录后从头重新搜索
+    enum class BudgetAction
+    {
+        Fail, Restart
+    };
+
+    /// @brief 各部分占用的堆内存（字节），按容器的容量计算
+    struct MemoryUsage
+    {
+        std::size_t domains = 0;    // 格子的可能性
+        std::size_t undo = 0;       // 撤销记录
+        std::size_t stack = 0;      // 搜索栈
+        std::size_t scratch = 0;    // 传播与前瞻的临时队列、访问标记
+        std::size_t select = 0;     // 待决定集合与选择策略的数据结构
+        std::size_t rules = 0;      // 规则的查找表与拓扑
+
+        std::size_t total() const noexcept {
+            return domains + undo + stack + scratch + select + rules;
+        }
+    };
 
     WaveFunctionCollapse(int height, int width, std::minstd_rand* gen_ptr = nullptr);
+    explicit WaveFunctionCollapse(Int3 size, std::minstd_rand* gen_ptr = nullptr);
+    explicit WaveFunctionCollapse(Topology topology, std::minstd_rand* gen_ptr = nullptr);
     WaveFunctionCollapse(const WaveFunctionCollapse&) = delete;
 
+    /// @brief 按当前的规则与尺寸重置所有格子，并预先分配求解所需的辅助内存
+    /// @details 按尺寸确定的辅助内存在这里一次分配；决定栈与撤销记录随搜索深度按倍数增长，
+    ///          `reset()` 之后保留容量，因此复用的求解器再次 `generate()` 时通常不再分配堆内存。
+    ///          邻接兼容表规则下，先从每个格子删去在其某个邻居方向上没有可以相邻的图块的图块（边界上的格子只检查存在的方向），
+    ///          再传播到不动点；这一步使某个格子变空时规则在此尺寸下无解，返回 false，矛盾的位置见 `getContradiction()`
     bool init();
+
+    /// @brief 以新的随机种子回到 `init()` 之后的状态
+    /// @details 只重新填充格子与待决定集合，格子恢复为 `init()` 分析之后的可能性而不再分析，
+    ///          保留已分配的内存、拓扑与规则的查找表，用于反复求解同一规则与尺寸的小地图；需要先调用过一次 `init()`，且其后规则与尺寸不变。
+    ///          构造时传入了外部的随机数生成器时重设的是这个生成器的种子，共用它的其他对象也会受影响
+    void reset(std::uint32_t seed);
+
+    bool propagate();
+    BitsetType get(Int3 pos) const;
     BitsetType get(Int2 pos) const;
+    bool set(Int3 pos, BitsetType bitset);
     bool set(Int2 pos, BitsetType bitset);
+    bool set(std::span<const std::pair<Int3, BitsetType>> presets);
+    bool set(std::span<const std::pair<Int2, BitsetType>> presets);
+    /// @brief 以整张掩码施加约束，`Matrix` 对应第 0 层；尺寸与求解器不一致时不做修改并返回 false
+    bool set(const Matrix3<BitsetType>& masks);
+    bool set(const Matrix<BitsetType>& masks);
     void backtrack();
+
+    /// @brief 推进至多 `max_steps` 步，一步为决定一个格子或撤销一次决定
+    /// @details 状态为 `Idle` 时先从当前的格子开始一次新的求解；`init()`、`reset()` 与 `backtrack()` 会回到 `Idle`。
+    ///          求解的全部状态保存在对象中，可以随时中断，之后继续调用即可接着求解
+    /// @return 推进后的状态
+    Status step(std::size_t max_steps = 1);
+
+    /// @brief 推进直到求解结束或超过 `deadline`，每一步之后检查一次时间
+    Status run_for(std::chrono::steady_clock::time_point deadline);
+
+    /// @brief 一次求解到结束，调用 `step()` 直到不再是 `Running`
+    /// @details 状态为 `Running`（例如之前调用过 `step()`）时接着当前的搜索求解；
+    ///          否则从当前的格子开始一次新的求解，未完成的搜索（例如 `OverBudget`）先撤销它的决定，预设保留
     bool generate();
-    Generator<std::pair<Int2, FactorType>> generate_async();
+
+    /// @brief 与 `generate()` 相同，但回溯超过 `max_backtracks` 次时停止并返回 false
+    /// @details 用于难解时换一个种子或放弃重试的场合；停止时状态仍为 `Running`，可以接着求解
+    bool solveWithin(std::size_t max_backtracks);
+
+    /// @brief 以格子数量的 4 倍为回溯次数的上限求解，见 `solveWithin(max_backtracks)`
+    bool solveWithin();
+
+    /// @brief 逐步求解，每一步产出 (格子, 图块)，撤销时图块为 -1
+    /// @details 与 `generate()` 相同，状态为 `Running` 时接着当前的搜索
+    Generator<std::pair<Int3, FactorType>> generate_async();
+
+    /// @brief 近似求解：不回溯的贪心坍缩，再以最小冲突的局部搜索修复
+    /// @details 按选择策略依次决定每个格子（最小熵改用 `Scanline`），从不回溯：某个格子的图块全部导致矛盾时，
+    ///          放置一个图块并跳过传播中会使格子变空的约束，被跳过的格子记为冲突并推迟到最后再选取图块；
+    ///          之后反复为冲突的格子换成与邻居冲突更少的图块，不能减少时交给与之冲突的邻居，
+    ///          直到没有冲突或达到 `max_repairs` 次。
+    ///          时间与格子数量近似成正比，用于精确搜索无法完成、允许少量瑕疵的大地图；不检查全局约束
+    /// @return 修复之后仍然与邻居冲突的格子数量，为 0 时结果满足规则
+    std::size_t generate_approx(std::size_t max_repairs = std::size_t(1) << 20);
+
+    /// @brief 最近一次 `generate_approx()` 之后仍然与邻居冲突的格子
+    std::vector<Int3> getConflicts() const;
+
+    /// @brief 当前搜索路径上的决定，求解完成（`Done`）后即为生成这张地图所需的全部决定
+    /// @details 按决定的顺序记录搜索路径上每个格子的 (格子, 图块)，包括决定时只剩一种可能的格子；
+    ///          每个决定编码为一个变长整数：与上一个格子下标之差（zigzag）左移 5 位后或上图块编号，
+    ///          按扫描线等顺序求解时通常每个决定只占 1 字节
+    std::vector<std::uint8_t> getDecisionLog() const;
+
+    /// @brief 回放 `getDecisionLog()` 记录的决定，只做约束传播，不选择格子、不使用随机数、不回溯
+    /// @details 需要与记录时相同的规则、尺寸与预设，结果与选择策略、随机种子和传播方式无关；全局约束不再检查。
+    ///          回放之后仍有未决定的格子时状态为 `Idle`，可以接着 `step()` 求解
+    /// @return 所有格子都已决定时返回 true；日志损坏或与当前规则矛盾时撤销本次回放并返回 false
+    bool replay(std::span<const std::uint8_t> log);
     void print() const;
 
-    Int2 getSize() const noexcept {
+    Status getStatus() const noexcept {
+        return status_;
+    }
+
+    /// @brief 最近一步的 (格子, 图块)，撤销时图块为 -1
+    std::pair<Int3, FactorType> getLastStep() const noexcept {
+        return {coord_(last_pos_), last_factor_};
+    }
+
+    /// @brief 本次求解中撤销决定的次数，可用于限制难解时的耗时
+    std::size_t getBacktracks() const noexcept {
+        return backtracks_;
+    }
+
+    /// @brief 当前占用的堆内存
+    MemoryUsage getMemoryUsage() const;
+
+    std::size_t getMemoryBudget() const noexcept {
+        return memory_budget_;
+    }
+
+    BudgetAction getBudgetAction() const noexcept {
+        return budget_action_;
+    }
+
+    std::size_t getMaxRestarts() const noexcept {
+        return max_restarts_;
+    }
+
+    /// @brief 设置内存预算（字节），0 表示不限制
+    /// @details 每次决定之后检查，求解中增长的只有撤销记录（包括全局约束的日志）与搜索栈；超出时按 `action` 处理。
+    ///          `Restart` 时因超出预算而重新开始的次数达到 `max_restarts` 后不再重新开始，状态为 `OverBudget`
+    void setMemoryBudget(std::size_t bytes, BudgetAction action = BudgetAction::Fail, std::size_t max_restarts = 8) noexcept {
+        memory_budget_ = bytes;
+        budget_action_ = action;
+        max_restarts_ = max_restarts;
+    }
+
+    std::size_t getRestartInterval() const noexcept {
+        return restart_interval_;
+    }
+
+    /// @brief 设置重新开始的间隔，0 表示不重新开始
+    /// @details 本次搜索中撤销决定的次数超过 `backtracks` 时撤销所有决定、从头重新搜索，之后每次间隔加倍，
+    ///          因此最终仍会穷尽搜索。前期的决定导致的无解只能靠逐个回溯纠正，
+    ///          全局约束（尤其是 `GlobalConstraints::setConnected`）下应当打开
+    void setRestartInterval(std::size_t backtracks) noexcept {
+        restart_interval_ = backtracks;
+    }
+
+    /// @brief 本次求解中重新开始的次数（超出内存预算或达到重新开始的间隔）
+    std::size_t getRestarts() const noexcept {
+        return restarts_;
+    }
+
+    /// @brief 获取尺寸 {层数, 行数, 列数}，二维时层数为 1
+    Int3 getSize() const noexcept {
         return size_;
     }
 
+    /// @brief 最近一次约束传播失败时变空的格子
+    Int3 getContradiction() const noexcept {
+        return contradiction_;
+    }
+
     FactorType getFactorCount() const noexcept {
         return static_cast<FactorType>(weights_.size());
     }
 
     BitsetType getFactorMask() const noexcept {
-        return (1u << getFactorCount()) - 1u;
+        // 32 种图块时 1u << 32 未定义
+        return getFactorCount() ? ~0u >> (32 - getFactorCount()) : 0u;
+    }
+
+    /// @brief 规则分析：远离地图边界时不可能出现的图块
+    /// @details 某个方向上没有可以相邻的图块，或者只能与这样的图块相邻；由 `setRule` 计算，函数形式的规则为 0。
+    ///          计算时把所有邻居都当作内部的格子，因此要求的邻居只能出现在边界上时，这样的图块仍可能出现在紧挨边界的格子中
+    BitsetType getDeadFactors() const noexcept {
+        return dead_factors_;
     }
 
     std::vector<WeightType>& getWeights() noexcept {
         return weights_;
     }
 
-    std::vector<std::pair<std::vector<Int2>, DiffuseFuncType>>& getDiffuseFuncs() noexcept {
+    std::vector<std::pair<std::vector<Int3>, DiffuseFuncType>>& getDiffuseFuncs() noexcept {
         return diffuse_funcs_;
     }
 
+    const Topology& getTopology() const noexcept {
+        return topology_;
+    }
+
+    /// @brief 使用自定义的拓扑（环面、六边形、任意图等），需要重新调用 `init()`
+    /// @details 边的标签即规则中的方向下标；自定义拓扑总是按队列传播
+    void setTopology(Topology topology);
+
+    Propagation getPropagation() const noexcept {
+        return propagation_;
+    }
+
+    void setPropagation(Propagation mode) noexcept {
+        propagation_ = mode;
+    }
+
+    ThreadPool* getThreadPool() const noexcept {
+        return pool_;
+    }
+
+    /// @brief 设置 `Propagation::Parallel` 使用的线程池，为空指针时按 `Queue` 传播
+    /// @note 线程池需要比求解器存活得更久，可以由多个求解器共用；
+    ///       不能是运行求解器本身的线程池：在其工作线程中求解时，能帮助传播的空闲线程随之减少，
+    ///       全部工作线程都在求解时并行传播退化为调用线程独自执行
+    void setThreadPool(ThreadPool* pool) noexcept {
+        pool_ = pool;
+    }
+
+    Heuristic getHeuristic() const noexcept {
+        return heuristic_;
+    }
+
+    /// @brief 设置选择策略，在下一次 `generate()` 时生效
+    void setHeuristic(Heuristic heuristic) noexcept {
+        heuristic_ = heuristic;
+    }
+
+    int getLookahead() const noexcept {
+        return lookahead_;
+    }
+
+    /// @brief 设置前瞻（单点弧相容）
+    /// @details 每次决定并传播之后，对这次传播改动过、剩余可能性在 2 ~ `max_options` 种之间的格子，
+    ///          逐一试探每个图块的传播并立即撤销，删去试探时就矛盾的图块；为 0 时关闭。
+    ///          试探只针对最近一次决定附近的格子，删去的图块记入撤销记录，回溯时一并恢复
+    void setLookahead(int max_options) noexcept {
+        lookahead_ = max_options;
+    }
+
+    GlobalConstraints* getConstraints() const noexcept {
+        return constraints_;
+    }
+
+    /// @brief 设置全局约束（见 `GlobalConstraints`），为空指针时不使用，在下一次开始求解时生效
+    /// @note 约束需要比求解器存活得更久
+    void setConstraints(GlobalConstraints* constraints) noexcept {
+        constraints_ = constraints;
+    }
+
+    /// @brief 使用编译期生成的邻接兼容表作为规则
+    /// @details 同时设置权重；设置后优先于 `getDiffuseFuncs()` 中的影响算法
+    template <std::size_t K, std::size_t D>
+    void setRule(const AdjacencyTable<K, D>& rule) {
+        std::vector<Int3> dirs(D);
+        std::vector<BitsetType> support(D * K);
+        for (std::size_t d = 0; d < D; ++d) {
+            dirs[d] = rule.dir(d);
+            for (std::size_t t = 0; t < K; ++t) {
+                support[d * K + t] = rule.support[d][t];
+            }
+        }
+        weights_.assign(rule.weights.begin(), rule.weights.end());
+        setRule(std::move(dirs), support);
+    }
+
+    /// @brief 使用运行时给出的邻接兼容表作为规则
+    /// @param dirs 各个方向的位移
+    /// @param support `support[d * getFactorCount() + t]` 为图块 `t` 在方向 `dirs[d]` 上允许的邻居集合
+    /// @note 需要先通过 `getWeights()` 设置图块数量与权重
+    void setRule(std::vector<Int3> dirs, const std::vector<BitsetType>& support);
+
+    /// @brief 决定生成结果的全部设置（图块权重、邻接兼容表、尺寸、选择策略、传播方式、前瞻、重新开始、内存预算与全局约束）的哈希值
+    /// @details 相同的哈希值与随机种子、预设得到相同的结果，可以作为缓存的键；
+    ///          函数形式的规则或自定义拓扑无法比较，返回 0
+    std::uint64_t getRuleHash() const;
+
+    /// @brief 清除邻接兼容表，恢复使用 `getDiffuseFuncs()`
+    void clearRule() noexcept {
+        rule_dirs_.clear();
+        rule_support_.clear();
+        rule_lut_.clear();
+        rule_viable_.clear();
+        dead_factors_ = 0u;
+    }
+
     constexpr static BitsetType toBitset(std::initializer_list<FactorType> factors) noexcept {
         BitsetType res = 0u;
         for (auto id : factors) res |= 1u << id;
@@ -78,23 +374,174 @@ public:
     }
 
 private:
-    // 随机数生成器
+    // 全局约束按求解器的存储位置编号格子
+    friend class GlobalConstraints;
+
+    // 随机数生成器，构造时未指定则使用自带的 gen_
     std::minstd_rand* gen_ptr_;
+    std::minstd_rand gen_;
+
+    // 矩阵尺寸和数据，格子以存储位置编号
+    // 按图块数量选用 8 / 16 / 32 位存储，由 init() 分配
+    Int3 size_;
+    std::variant<Matrix3<std::uint8_t>, Matrix3<std::uint16_t>, Matrix3<std::uint32_t>> mat_;
 
-    // 矩阵尺寸和数据
-    Int2 size_;
-    Matrix<Node> mat_;
-    std::unordered_set<Int2> todo_set_;
+    // 尚未决定的格子（稀疏集合），todo_pos_[i] 为格子 i 在 todo_ 中的位置，不在其中时为 -1
+    std::vector<int> todo_;
+    std::vector<int> todo_pos_;
 
     std::vector<WeightType> weights_;
-    std::vector<std::pair<std::vector<Int2>, DiffuseFuncType>> diffuse_funcs_;
+    std::vector<std::pair<std::vector<Int3>, DiffuseFuncType>> diffuse_funcs_;
+
+    // 格子之间的邻接关系，未指定时由 init() 按规则的方向生成有界网格
+    Topology topology_;
+    bool custom_topology_ = false;
+    // 函数形式的规则中，每个标签对应的影响算法在 diffuse_funcs_ 中的下标，-1 表示不受约束
+    std::vector<int> label_funcs_;
+
+    // 邻接兼容表，按 8 个图块一组展开为查找表
+    // rule_lut_[(d * 4 + chunk) * 256 + byte] 为该组图块在方向 d 上允许的邻居并集
+    std::vector<Int3> rule_dirs_;
+    std::vector<BitsetType> rule_support_;
+    std::vector<BitsetType> rule_lut_;
+    // 规则分析，rule_viable_[d] 为在方向 d 上存在可以相邻的图块的图块
+    std::vector<BitsetType> rule_viable_;
+    BitsetType dead_factors_ = 0u;
+    // init() 分析之后可能性不是全集的格子及其初始的可能性，reset() 据此恢复而不再分析
+    std::vector<std::pair<int, BitsetType>> initial_;
+
+    // sweep 的辅助变量
+    // sweep_dirs_ 为展开后的所有方向，函数形式的规则同时记录对应的影响算法，由 init() 建立
+    // sweep_dirty_[z * rows + y] 表示该行需要作为约束来源重新扫描
+    Propagation propagation_ = Propagation::Queue;
+    std::vector<std::pair<Int3, const DiffuseFuncType*>> sweep_dirs_;
+    std::vector<char> sweep_dirty_;
+    std::vector<char> sweep_next_;
+    std::vector<int> sweep_changed_;
+    std::vector<BitsetType> sweep_old_;
+
+    // 并行传播
+    // par_mask_ 为本层施加到每个格子上的约束之交（初值为全集），par_next_ / par_backup_ 为每个分块的下一层与撤销记录
+    ThreadPool* pool_ = nullptr;
+    std::vector<BitsetType> par_mask_;
+    std::vector<std::vector<int>> par_next_;
+    std::vector<std::vector<std::pair<int, Node>>> par_backup_;
+
+    // 选择策略
+    // 按顺序选择时 order_[rank] 为第 rank 个格子，rank_ 为其逆映射，两者为空时表示存储顺序
+    // cursor_ 之前的格子都已决定
+    // find_mode_ 为本次求解实际使用的策略，对应的数据结构由 prepareFind_() 建立
+    Heuristic heuristic_ = Heuristic::Entropy;
+    Heuristic find_mode_ = Heuristic::Entropy;
+    std::vector<int> order_;
+    std::vector<int> rank_;
+    int cursor_ = 0;
+    // MRV：按可能性数量分桶的循环双向链表，同一桶内先进先出，bucket_of_ 为 -1 表示不在任何桶中
+    std::vector<int> bucket_head_;
+    std::vector<int> bucket_next_;
+    std::vector<int> bucket_prev_;
+    std::vector<std::int8_t> bucket_of_;
+
+    // 近似求解：approx_ 为真时传播跳过会清空格子的约束，conflicts_ 为冲突的格子
+    bool approx_ = false;
+    std::vector<int> conflicts_;
+
+    // 前瞻：试探的可能性上限，probe_ 为待试探的格子
+    int lookahead_ = 0;
+    std::vector<int> probe_;
+
+    // 全局约束：backup_ 中 notified_ 之前的修改已经报告给约束
+    GlobalConstraints* constraints_ = nullptr;
+    std::size_t notified_ = 0;
 
     // diffuse 的辅助变量
-    Matrix<bool> vis_;
-    std::map<Int2, Node> backup_;
+    // vis_ 为 0 表示未访问，1 表示已加入下一层，2 表示已访问
+    Matrix3<std::uint8_t> vis_;
+    std::vector<int> layer_;
+    std::vector<int> next_layer_;
+    Int3 contradiction_{-1, -1, -1};
+
+    // 撤销记录：按修改顺序保存 (格子, 旧值)，逆序恢复
+    std::vector<std::pair<int, Node>> backup_;
+
+    // 搜索栈，pos 为决定的格子，options 为决定之前的可能性，remaining 为尚未尝试的图块，mark 为决定之前 backup_ 的长度
+    struct State
+    {
+        int pos;
+        BitsetType options;
+        BitsetType remaining;
+        std::size_t mark;
+    };
+    std::vector<State> states_;
+    Status status_ = Status::Idle;
+    int last_pos_ = 0;
+    FactorType last_factor_ = -1;
+    std::size_t backtracks_ = 0;
+    // 内存预算，0 表示不限制
+    std::size_t memory_budget_ = 0;
+    BudgetAction budget_action_ = BudgetAction::Fail;
+    // 因超出预算而重新开始的次数上限与本次求解中的次数
+    std::size_t max_restarts_ = 8;
+    std::size_t budget_restarts_ = 0;
+    std::size_t restarts_ = 0;
+    // 重新开始的间隔；restart_step_ 为当前的间隔，回溯次数达到 restart_after_ 时重新开始
+    std::size_t restart_interval_ = 0;
+    std::size_t restart_step_ = 0;
+    std::size_t restart_after_ = 0;
+
+    class FuncSupport;
+    template <int Chunks>
+    class TableSupport;
+
+    void todoInsert_(int idx);
+    void todoErase_(int idx);
+    void bucketInsert_(int idx, BitsetType bitset);
+    void bucketErase_(int idx);
+    void touch_(std::size_t mark);
+    void prepareFind_();
+    void restore_(std::size_t mark);
+    void start_();
+    void push_();
+    void advance_();
+    bool probe_cells_(std::size_t mark);
+    BitsetType allowed_(int label, FactorType factor) const;
+    int conflictCount_(int idx, FactorType factor) const;
+    bool notify_();
+    void restart_();
+    void abandon_();
+    int find_();
+    int findEntropy_() const;
+    bool buildTopology_();
+    bool analyze_();
+    bool diffuse_(int idx, Node node);
+    bool spread_(std::span<const int> seeds, std::size_t mark);
+    bool spreadQueue_(std::span<const int> seeds, std::size_t mark);
+    bool sweep_(std::size_t mark);
+    template <typename T, typename Support>
+    bool diffuse_impl_(Matrix3<T>& cells, std::span<const int> seeds, std::size_t mark, Support support);
+    template <typename T>
+    bool sweep_impl_(Matrix3<T>& cells, std::size_t mark);
+    template <typename T, typename Support>
+    bool parallel_layer_(Matrix3<T>& cells, Support support);
+
+    // 所有格子数组的排列相同，借用 vis_ 换算下标
+    std::size_t index_(Int3 pos) const noexcept {
+        return vis_.index(pos);
+    }
+
+    Int3 coord_(std::size_t idx) const noexcept {
+        return vis_.coord(idx);
+    }
 
-    Int2 find_() const;
-    bool diffuse_(Int2 pos, Node node);
+    BitsetType load_(std::size_t idx) const noexcept {
+        return std::visit([idx](const auto& cells) -> BitsetType { return cells[idx]; }, mat_);
+    }
+
+    void store_(std::size_t idx, BitsetType bitset) noexcept {
+        std::visit([idx, bitset](auto& cells) {
+            cells[idx] = static_cast<typename std::decay_t<decltype(cells)>::value_type>(bitset);
+        }, mat_);
+    }
 };
 
 
@@ -121,7 +568,7 @@ public:
     }
 
     double getEntropy(const WaveFunctionCollapse& wfc) const;
-    std::vector<FactorType> collapse(const WaveFunctionCollapse& wfc) const;
+    FactorType pick(const WaveFunctionCollapse& wfc) const;
 };
 
 
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstdint>
+#include <random>
+#include <span>
+#include <vector>
+#include "tools/index2.hpp"
+#include "tools/matrix.hpp"
+#include "wfc.h"
+#include "wfc_rule.hpp"
+namespace cha
+{
+
+
+
+/// @brief 同一规则与尺寸的大量小地图的批量求解，多张地图在 SIMD 通道中同步推进
+/// @details 每个格子连续存放 8 张（AVX-512 下为 16 张）地图的可能性，各占一个通道：
+///          所有通道按扫描线顺序同时决定同一个格子（各自以自己的 xorshift 随机数按权重选取图块），
+///          再对所有通道一起做约束传播，每次施加约束都是一条向量运算。
+///          某个通道的决定导致矛盾时，只撤销该通道在这一步的修改，去掉失败的图块后交给标量求解器完成，
+///          其余通道不受影响，继续同步求解。每张地图的结果只取决于自己的种子，与批次的组成和指令集无关。
+///          细图块的规则只支持 `DIR4`。
+class BatchCollapse
+{
+public:
+    using FactorType = WaveFunctionCollapse::FactorType;
+    using BitsetType = WaveFunctionCollapse::BitsetType;
+    using WeightType = WaveFunctionCollapse::WeightType;
+
+    /// @brief 构造函数
+    /// @param size 每张地图的尺寸
+    /// @param rule 细图块的规则
+    template <std::size_t K>
+    BatchCollapse(Int2 size, const AdjacencyTable<K, 4>& rule)
+        : BatchCollapse(size, supportOf_(rule), std::vector<WeightType>(rule.weights.begin(), rule.weights.end())) {}
+
+    /// @brief 构造函数
+    /// @param support `support[d * 图块数量 + t]` 为图块 `t` 在方向 `DIR4[d]` 上允许的邻居集合
+    /// @param weights 每个图块的权重
+    BatchCollapse(Int2 size, std::vector<BitsetType> support, std::vector<WeightType> weights);
+
+    /// @brief 求解 `seeds.size()` 张地图，第 i 张以 `seeds[i]` 为随机种子
+    /// @param out 结果，每个格子为图块编号；求解失败的地图所有格子为 -1
+    /// @return 所有地图都求解成功时返回 true
+    bool generate(std::span<const std::uint32_t> seeds, std::vector<Matrix<FactorType>>& out);
+
+    /// @brief 同时求解的地图数量（通道数），按运行时检测到的指令集选择
+    static int getLanes() noexcept;
+
+    Int2 getSize() const noexcept {
+        return size_;
+    }
+
+    /// @brief 最近一次 `generate` 中因矛盾而交给标量求解器的地图数量
+    std::size_t getFallbacks() const noexcept {
+        return fallbacks_;
+    }
+
+private:
+    Int2 size_;
+    std::vector<BitsetType> support_;
+    std::vector<WeightType> weights_;
+    // 同步求解时使用的权重，之和不超过 0xff00 加图块数量
+    std::vector<BitsetType> lane_weights_;
+    std::size_t fallbacks_ = 0;
+
+    // 标量求解器，同时提供经过规则分析的初始状态
+    std::minstd_rand gen_;
+    WaveFunctionCollapse fallback_;
+    std::vector<BitsetType> initial_;
+
+    // 同步求解的辅助内存，格子 i 的通道 l 位于 cells_[i * 通道数 + l]
+    // retired_ 保存中途离开的通道的可能性，trail_ 为一步之内的撤销记录
+    std::vector<BitsetType> cells_;
+    std::vector<BitsetType> retired_;
+    std::vector<int> queue_;
+    std::vector<char> queued_;
+    std::vector<int> trail_pos_;
+    std::vector<BitsetType> trail_old_;
+
+    // 构造时就要以规则初始化标量求解器，因此先展开邻接兼容表
+    template <std::size_t K>
+    static std::vector<BitsetType> supportOf_(const AdjacencyTable<K, 4>& rule) {
+        std::vector<BitsetType> res(4 * K);
+        for (std::size_t d = 0; d < 4; ++d) {
+            for (std::size_t t = 0; t < K; ++t) {
+                res[d * K + t] = rule.support[d][t];
+            }
+        }
+        return res;
+    }
+
+    bool solveScalar_(const BitsetType* domains, std::uint32_t seed, Matrix<FactorType>& out);
+};
+
+
+
+} // namespace cha
@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include "tools/index2.hpp"
+#include "tools/mapped_file.hpp"
+#include "wfc.h"
+namespace cha
+{
+
+
+
+/// @brief 以内容寻址的生成结果缓存，保存在磁盘上的只追加文件中
+/// @details 键为规则哈希（`WaveFunctionCollapse::getRuleHash()`）与请求参数的哈希，
+///          值为逐行排列的 `uint8` 图块。文件由一个文件头和依次追加的记录组成，
+///          每条记录同时保存规则哈希与请求参数，命中时逐项比较，键的碰撞不会返回错误的结果。
+///          打开时扫描记录头建立内存中的索引，末尾不完整的记录被截掉。
+///          命中时直接返回映射内存中的图块，不做任何解析；
+///          文件超过容量时按最近最少使用保留一半容量的记录，重写文件。
+///          同一进程内的并发读写是安全的，多个进程不能同时写入同一个文件。
+class MapCache
+{
+public:
+    using BitsetType = WaveFunctionCollapse::BitsetType;
+
+    /// @brief 一次命中的结果，持有映射，在其存活期间 `tiles` 一直有效
+    struct Entry
+    {
+        std::shared_ptr<const MappedFile> file;
+        Int2 size;
+        std::span<const std::uint8_t> tiles;
+
+        explicit operator bool() const noexcept {
+            return file != nullptr;
+        }
+    };
+
+    /// @brief 构造函数，打开或创建缓存文件
+    /// @param path 缓存文件的路径，文件不存在或为空时创建
+    /// @param capacity 文件大小的上限（字节）
+    /// @param overwrite 文件已存在但文件头不符（不是缓存文件或版本不同）时是否清空重建；为 false 时不修改文件，`isOpen()` 为 false
+    explicit MapCache(std::string path, std::size_t capacity = std::size_t(256) << 20, bool overwrite = false);
+
+    MapCache(const MapCache&) = delete;
+    MapCache& operator=(const MapCache&) = delete;
+    ~MapCache();
+
+    /// @brief 文件是否可以写入
+    bool isOpen() const noexcept {
+        return file_ != nullptr;
+    }
+
+    /// @brief 由规则哈希与请求参数计算键，规则哈希为 0（不可缓存）时返回 0
+    static std::uint64_t keyOf(std::uint64_t rule_hash, Int2 size, std::uint32_t seed,
+                               std::span<const std::pair<Int2, BitsetType>> presets);
+
+    /// @brief 查找，未命中或规则哈希为 0 时返回空的 `Entry`
+    Entry find(std::uint64_t rule_hash, Int2 size, std::uint32_t seed,
+               std::span<const std::pair<Int2, BitsetType>> presets);
+
+    /// @brief 写入一个结果，键已存在时忽略
+    /// @param tiles 逐行排列的图块，数量为 `size.y * size.x`
+    /// @return 写入失败或规则哈希为 0 时返回 false
+    bool insert(std::uint64_t rule_hash, Int2 size, std::uint32_t seed,
+                std::span<const std::pair<Int2, BitsetType>> presets, std::span<const std::uint8_t> tiles);
+
+    /// @brief 记录的数量
+    std::size_t count() const;
+
+    /// @brief 文件的大小（字节）
+    std::size_t bytes() const;
+
+private:
+    struct Slot
+    {
+        std::size_t offset;
+        std::size_t length;  // 记录的总长度（字节）
+        std::atomic<std::uint64_t> used;
+    };
+
+    std::string path_;
+    std::size_t capacity_;
+    std::FILE* file_ = nullptr;
+    std::size_t bytes_ = 0;
+    std::atomic<std::uint64_t> clock_{0};
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<std::uint64_t, Slot> index_;
+    std::shared_ptr<const MappedFile> map_;
+
+    bool open_(bool overwrite);
+    void remap_();
+    bool compact_();
+};
+
+
+
+} // namespace cha
@@ -0,0 +1,138 @@
+#pragma once
+#include <climits>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "tools/index2.hpp"
+#include "tools/index3.hpp"
+#include "wfc.h"
+#include "wfc_rule.hpp"
+namespace cha
+{
+
+
+
+/// @brief 求解过程中增量检查的全局约束：管道连通、两点之间的通路、每种图块的数量上下限
+/// @details 每个图块给出向外连通的方向标签集合（如管道的开口），已决定的格子中
+///          相邻且互相连通的格子以可撤销的并查集合并为连通块，并记录每块通向未决定格子的开口数量；
+///          开口数量为 0 的块不会再增长，称为封闭的块。
+///          数量限制以计数器维护已决定的个数与仍可能出现的个数。
+///          所有修改记入日志，求解器回溯时按日志撤销，每次决定之后只处理这一步改动过的格子。
+///          连通块之间、通路两端之间能否经由未决定的格子相连，只从这一步改动过的格子附近搜索，
+///          各处的搜索相遇之后即停止，不必遍历整张地图。
+///          通过 `WaveFunctionCollapse::setConstraints` 使用，一个对象同时只能被一个求解器使用。
+class GlobalConstraints
+{
+public:
+    using FactorType = WaveFunctionCollapse::FactorType;
+    using BitsetType = WaveFunctionCollapse::BitsetType;
+
+    /// @brief 设置每个图块向外连通的方向，`links[t]` 的第 d 位表示图块 `t` 在标签为 d 的方向上连通
+    void setLinks(std::vector<BitsetType> links) {
+        links_ = std::move(links);
+    }
+
+    /// @brief 由邻接兼容表的接口设置连通的方向，接口不为 `closed` 的方向视为连通
+    template <std::size_t K, std::size_t D>
+    void setLinks(const AdjacencyTable<K, D>& rule, int closed = 0) {
+        links_.assign(K, 0u);
+        for (std::size_t t = 0; t < K; ++t) {
+            for (std::size_t d = 0; d < D; ++d) {
+                if (rule.sockets[t][d] != closed) links_[t] |= 1u << d;
+            }
+        }
+    }
+
+    /// @brief 要求所有连通的图块（管道）组成一个整体，需要先 `setLinks`
+    void setConnected(bool connected) noexcept {
+        connected_ = connected;
+    }
+
+    /// @brief 要求两个格子之间有通路，两者都必须是连通的图块，需要先 `setLinks`；端点超出地图时无解
+    void addPath(Int3 a, Int3 b) {
+        paths_.emplace_back(a, b);
+    }
+
+    void addPath(Int2 a, Int2 b) {
+        addPath(Int3(a), Int3(b));
+    }
+
+    /// @brief 限制图块 `tile` 的数量在 [min, max] 之间
+    void setCount(FactorType tile, int min, int max = INT_MAX);
+
+    /// @brief 清除所有约束
+    void clear();
+
+private:
+    friend class WaveFunctionCollapse;
+
+    std::vector<BitsetType> links_;
+    bool connected_ = false;
+    std::vector<std::pair<Int3, Int3>> paths_;
+    std::vector<int> min_;
+    std::vector<int> max_;
+
+    const Topology* topology_ = nullptr;
+    BitsetType linked_ = 0;
+    std::vector<std::pair<int, int>> path_cells_;
+
+    // 以下状态的修改均记入 journal_，(位置, 旧值)
+    // known_ 为约束已知的格子状态；decided_、possible_ 为每种图块已决定的个数与仍可能出现的个数
+    // parent_、count_、open_ 为并查集（按大小合并、不压缩路径以便撤销），count_ 与 open_ 在根上有效
+    // components_ 为连通块数量，closed_ 为封闭的块数量
+    std::vector<int> known_;
+    std::vector<int> decided_;
+    std::vector<int> possible_;
+    std::vector<int> parent_;
+    std::vector<int> count_;
+    std::vector<int> open_;
+    int components_ = 0;
+    int closed_ = 0;
+    std::vector<std::pair<int*, int>> journal_;
+    // 检查点 (撤销记录的长度, journal_ 的长度)
+    std::vector<std::pair<std::size_t, std::size_t>> checkpoints_;
+
+    // 可达性搜索的辅助内存，reach_mark_ 等于 epoch_ 的格子本次已访问，reach_owner_ 为访问它的搜索
+    // 相遇的搜索以 searches_ 上的并查集合并，每个搜索记录队列中剩余的格子数与访问到的已决定的连通格子数
+    struct Search
+    {
+        int parent;
+        int pending;
+        int decided;
+    };
+    mutable std::vector<unsigned> reach_mark_;
+    mutable std::vector<int> reach_owner_;
+    mutable std::vector<int> reach_queue_;
+    mutable std::vector<Search> searches_;
+    mutable unsigned epoch_ = 0;
+    // changed_ 为上次提交之后改动过的格子；full_ 为 true 时下次检查从所有格子出发
+    std::vector<int> changed_;
+    bool full_ = true;
+
+    // 由求解器调用：开始求解时重建状态，之后逐个报告改动的格子，在每次决定之后提交并检查
+    void start_(const WaveFunctionCollapse& wfc);
+    void change_(int idx, BitsetType bitset);
+    bool commit_(std::size_t position);
+    void rollback_(std::size_t position);
+    void release_();
+    void memoryUsage_(WaveFunctionCollapse::MemoryUsage& usage) const;
+
+    void set_(int& slot, int value) {
+        journal_.emplace_back(&slot, slot);
+        slot = value;
+    }
+
+    int find_(int idx) const noexcept;
+    void decide_(int idx, FactorType factor);
+    void setOpen_(int root, int open);
+    void unite_(int a, int b);
+    bool check_() const;
+    bool checkReach_() const;
+    bool passable_(int from, int label, int to) const;
+    int findSearch_(int search) const noexcept;
+    std::uint64_t hash_() const;
+};
+
+
+
+} // namespace cha
@@ -0,0 +1,124 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "tools/index2.hpp"
+#include "tools/matrix.hpp"
+#include "wfc.h"
+#include "wfc_rule.hpp"
+namespace cha
+{
+
+
+
+/// @brief 由粗到细的分层生成，用于非常大的地图
+/// @details 先在块的粒度上求解元图块，每个元图块对应一组允许使用的细图块；
+///          再把每个块细化为 `block`×`block` 的格子，块与块之间按棋盘格分两轮并行求解：
+///          第一轮的块以相邻块的元图块作为边界条件，第二轮的块以第一轮的结果作为边界条件。
+///          块边缘 `margin` 宽的一圈格子不受元图块限制，作为块与块之间的接缝。
+///          某个块失败时，连同周围一圈的块一起重新求解，仍然失败时再放开元图块的限制。
+///          细图块的规则只支持 `DIR4`。
+class HierarchicalCollapse
+{
+public:
+    using FactorType = WaveFunctionCollapse::FactorType;
+    using BitsetType = WaveFunctionCollapse::BitsetType;
+    using WeightType = WaveFunctionCollapse::WeightType;
+
+    /// @brief 构造函数，元图块由细图块的接口自动推导
+    /// @details 每种细图块用到的接口编号构成一个集合，每个不同的集合对应一个元图块，
+    ///          元图块允许使用接口集合是其子集的所有细图块。
+    ///          例如管道规则得到“空白”与“管道与空白”两种元图块。
+    /// @param size 地图尺寸
+    /// @param block 块的边长
+    /// @param rule 细图块的规则
+    /// @param seed 随机种子，结果与线程数量无关
+    template <std::size_t K>
+    HierarchicalCollapse(Int2 size, int block, const AdjacencyTable<K, 4>& rule, std::uint32_t seed = 0)
+        : HierarchicalCollapse(size, block, std::vector<BitsetType>(4 * K), std::vector<WeightType>(K), seed) {
+        for (std::size_t d = 0; d < 4; ++d) {
+            for (std::size_t t = 0; t < K; ++t) {
+                support_[d * K + t] = rule.support[d][t];
+            }
+        }
+        weights_.assign(rule.weights.begin(), rule.weights.end());
+        std::vector<std::vector<int>> sockets(K);
+        for (std::size_t t = 0; t < K; ++t) {
+            sockets[t].assign(rule.sockets[t].begin(), rule.sockets[t].end());
+        }
+        setClasses(classesOf_(sockets));
+    }
+
+    /// @brief 构造函数
+    /// @param support `support[d * 图块数量 + t]` 为图块 `t` 在方向 `DIR4[d]` 上允许的邻居集合
+    /// @param weights 每个图块的权重
+    /// @note 需要再通过 `setClasses` 给出元图块
+    HierarchicalCollapse(Int2 size, int block, std::vector<BitsetType> support, std::vector<WeightType> weights,
+                         std::uint32_t seed = 0);
+
+    /// @brief 设置元图块，`classes[c]` 为元图块 `c` 允许使用的细图块集合
+    /// @details 元图块之间的规则自动推导：方向 d 上 a 与 b 可以相邻，当且仅当存在可以相邻的细图块
+    void setClasses(std::vector<BitsetType> classes);
+
+    /// @brief 显式给出元图块之间的规则，`support[d * 元图块数量 + c]` 的含义同细图块
+    void setCoarseRule(std::vector<BitsetType> support);
+
+    /// @brief 设置块边缘不受元图块限制的宽度，为块与块之间的接缝留出余地，默认为 1
+    void setMargin(int margin) noexcept {
+        margin_ = margin;
+    }
+
+    /// @brief 设置工作线程数量，0 表示取硬件并发数
+    void setThreads(std::size_t threads) noexcept {
+        threads_ = threads;
+    }
+
+    bool generate();
+
+    Int2 getSize() const noexcept {
+        return size_;
+    }
+
+    /// @brief 块的数量 {行数, 列数}
+    Int2 getBlocks() const noexcept {
+        return {(size_.y + block_ - 1) / block_, (size_.x + block_ - 1) / block_};
+    }
+
+    /// @brief 细图块，未求解时为 -1
+    FactorType get(Int2 pos) const {
+        return map_[pos];
+    }
+
+    /// @brief 块所在的元图块
+    FactorType getClass(Int2 block) const {
+        return coarse_[block];
+    }
+
+    const Matrix<FactorType>& getMap() const noexcept {
+        return map_;
+    }
+
+private:
+    Int2 size_;
+    int block_;
+    int margin_ = 1;
+    std::uint32_t seed_;
+    std::size_t threads_ = 0;
+
+    std::vector<BitsetType> support_;
+    std::vector<WeightType> weights_;
+    std::vector<BitsetType> classes_;
+    std::vector<BitsetType> coarse_support_;
+
+    Matrix<FactorType> coarse_;
+    Matrix<FactorType> map_;
+
+    bool solveCoarse_();
+    static std::vector<BitsetType> classesOf_(std::vector<std::vector<int>> sockets);
+    bool solveWindow_(Int2 tl, Int2 br, std::uint32_t seed, bool relax = false);
+    BitsetType classMask_(Int2 pos) const noexcept;
+    std::uint32_t seedOf_(Int2 block, std::uint32_t salt) const noexcept;
+};
+
+
+
+} // namespace cha
@@ -0,0 +1,112 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "tools/index3.hpp"
+#include "wfc.h"
+namespace cha
+{
+
+
+
+/// @brief 线程安全的求解器缓存，按 (规则, 尺寸) 复用已经初始化的求解器
+/// @details 先通过 `addRule` 登记规则的设置方法，之后 `acquire` 取出一个已经 `init()`、
+///          并以给定种子 `reset()` 的求解器；租约析构时求解器回到缓存，下次取出时只需 `reset()`。
+///          每个求解器使用自带的随机数生成器，不同线程同时持有的求解器互不影响。
+///          租约期间可以修改选择策略、传播方式、前瞻、重新开始、内存预算、线程池与全局约束，交还时恢复为取出时的设置；
+///          不能修改规则、权重与拓扑，邻接兼容表规则的求解器被修改过时在交还时销毁而不回到缓存。
+class SolverPool
+{
+public:
+    /// @brief 规则的设置方法，对新构造的求解器设置规则、权重、拓扑等
+    using SetupType = std::function<void(WaveFunctionCollapse&)>;
+
+    /// @brief 取出时求解器的设置，交还时恢复
+    struct Settings
+    {
+        std::uint64_t hash = 0;
+        WaveFunctionCollapse::Heuristic heuristic{};
+        WaveFunctionCollapse::Propagation propagation{};
+        int lookahead = 0;
+        std::size_t restart_interval = 0;
+        std::size_t memory_budget = 0;
+        WaveFunctionCollapse::BudgetAction budget_action{};
+        std::size_t max_restarts = 0;
+        ThreadPool* thread_pool = nullptr;
+        GlobalConstraints* constraints = nullptr;
+
+        static Settings of(const WaveFunctionCollapse& wfc);
+        void apply(WaveFunctionCollapse& wfc) const;
+    };
+
+    /// @brief 租约析构时把求解器交还缓存，租约不能比缓存存活得更久
+    class Release
+    {
+    public:
+        SolverPool* pool = nullptr;
+        int rule = -1;
+        Int3 size{};
+        Settings settings{};
+
+        void operator()(WaveFunctionCollapse* wfc) const;
+    };
+
+    using Lease = std::unique_ptr<WaveFunctionCollapse, Release>;
+
+    /// @brief 构造函数
+    /// @param max_idle 每个 (规则, 尺寸) 最多缓存的空闲求解器数量，多余的在交还时销毁
+    /// @param max_keys 最多缓存的 (规则, 尺寸) 种类，超出时销毁最久未使用的一种
+    explicit SolverPool(std::size_t max_idle = 16, std::size_t max_keys = 64)
+        : max_idle_(max_idle), max_keys_(max_keys) {}
+
+    SolverPool(const SolverPool&) = delete;
+    SolverPool& operator=(const SolverPool&) = delete;
+
+    /// @brief 登记一种规则
+    /// @return 规则编号
+    int addRule(SetupType setup);
+
+    /// @brief 取出一个可以直接求解的求解器
+    /// @param rule `addRule` 返回的规则编号
+    /// @param size 尺寸 {层数, 行数, 列数}
+    /// @param seed 随机种子
+    /// @return 规则编号无效或 `init()` 失败时返回空指针
+    Lease acquire(int rule, Int3 size, std::uint32_t seed);
+
+    Lease acquire(int rule, Int2 size, std::uint32_t seed) {
+        return acquire(rule, Int3(1, size.y, size.x), seed);
+    }
+
+    /// @brief 缓存中空闲的求解器数量
+    std::size_t idle() const;
+
+    /// @brief 销毁所有空闲的求解器
+    void clear();
+
+private:
+    using KeyType = std::pair<int, Int3>;
+
+    // 同一 (规则, 尺寸) 的空闲求解器，used 为最近一次取出或交还的时刻
+    struct IdleList
+    {
+        std::vector<std::unique_ptr<WaveFunctionCollapse>> solvers;
+        std::uint64_t used = 0;
+    };
+
+    std::size_t max_idle_;
+    std::size_t max_keys_;
+    mutable std::mutex mutex_;
+    std::vector<SetupType> setups_;
+    std::map<KeyType, IdleList> idle_;
+    std::uint64_t tick_ = 0;
+
+    void release_(int rule, Int3 size, const Settings& settings, WaveFunctionCollapse* wfc);
+};
+
+
+
+} // namespace cha
@@ -0,0 +1,106 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "tools/index2.hpp"
+#include "tools/matrix.hpp"
+#include "wfc.h"
+#include "wfc_rule.hpp"
+namespace cha
+{
+
+
+
+/// @brief 预先求解的块（Wang 图块）库，用于在请求时不经搜索地拼接地图
+/// @details 每个块为 `block`×`block` 的格子，相邻的块共用一行（列）格子，
+///          因此两块可以相邻当且仅当共用的边完全相同，以边的哈希值查找即可。
+///          离线构建时选定一个角图块，生成 `colors` 种横向边与 `colors` 种纵向边（两端均为角图块），
+///          再对四条边的每种组合求解一个块。
+///          拼接时按行优先的顺序，为每个块查找上边与左边都与已放置的邻居相同的块并随机选取一个；
+///          没有匹配时以邻居的边为预设就地求解一个新块，并加入库中。
+///          细图块的规则只支持 `DIR4`。
+class PrefabLibrary
+{
+public:
+    using FactorType = WaveFunctionCollapse::FactorType;
+    using BitsetType = WaveFunctionCollapse::BitsetType;
+    using WeightType = WaveFunctionCollapse::WeightType;
+
+    /// @brief 构造函数
+    /// @param block 块的边长，至少为 2
+    /// @param rule 细图块的规则
+    template <std::size_t K>
+    PrefabLibrary(int block, const AdjacencyTable<K, 4>& rule)
+        : PrefabLibrary(block, std::vector<BitsetType>(4 * K), std::vector<WeightType>(rule.weights.begin(), rule.weights.end())) {
+        for (std::size_t d = 0; d < 4; ++d) {
+            for (std::size_t t = 0; t < K; ++t) {
+                support_[d * K + t] = rule.support[d][t];
+            }
+        }
+    }
+
+    /// @brief 构造函数
+    /// @param support `support[d * 图块数量 + t]` 为图块 `t` 在方向 `DIR4[d]` 上允许的邻居集合
+    /// @param weights 每个图块的权重
+    PrefabLibrary(int block, std::vector<BitsetType> support, std::vector<WeightType> weights);
+
+    /// @brief 离线构建块库
+    /// @param colors 横向边与纵向边各自的种类数，块的数量至多为 `colors` 的四次方
+    /// @param seed 随机种子
+    /// @param threads 工作线程数量，0 表示取硬件并发数
+    /// @return 找不到可用的角图块或边时返回 false
+    bool build(int colors, std::uint32_t seed, std::size_t threads = 0);
+
+    /// @brief 拼接一张地图
+    /// @param size 地图尺寸
+    /// @param seed 随机种子
+    /// @param out 结果，每个格子为细图块编号
+    /// @return 就地求解也失败时返回 false
+    bool assemble(Int2 size, std::uint32_t seed, Matrix<FactorType>& out);
+
+    /// @brief 保存到文件 / 从文件读取，读取时块的边长与图块数量必须与构造时一致
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+    int getBlock() const noexcept {
+        return block_;
+    }
+
+    /// @brief 块的数量
+    std::size_t size() const noexcept {
+        return prefabs_.size();
+    }
+
+    /// @brief 最近一次 `assemble` 中就地求解的块数
+    std::size_t getFallbacks() const noexcept {
+        return fallbacks_;
+    }
+
+private:
+    struct Prefab
+    {
+        std::vector<std::uint8_t> tiles;
+        // 四条边（上、左、右、下）的哈希值
+        std::uint64_t edges[4];
+    };
+
+    int block_;
+    std::vector<BitsetType> support_;
+    std::vector<WeightType> weights_;
+
+    std::vector<Prefab> prefabs_;
+    // 以 (上边, 左边) 的哈希值为键，任意一边为 0 表示不限制
+    std::unordered_map<std::uint64_t, std::vector<int>> lookup_;
+    std::size_t fallbacks_ = 0;
+
+    static std::uint64_t keyOf_(std::uint64_t top, std::uint64_t left) noexcept;
+    std::uint64_t edgeOf_(const std::vector<std::uint8_t>& tiles, int edge) const;
+    void add_(std::vector<std::uint8_t> tiles);
+    bool solve_(const std::vector<std::pair<Int2, BitsetType>>& presets, Int2 size, std::uint32_t seed,
+                std::vector<std::uint8_t>& tiles) const;
+};
+
+
+
+} // namespace cha
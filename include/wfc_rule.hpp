@@ -0,0 +1,193 @@
+/*
+ * wfc_rule.hpp
+ * Created on 2026.10.19 by RZIN
+ *
+ * 编译期规则描述：由图块各面的接口（socket）与对称性
+ * 在编译期生成每个方向的邻接兼容表
+ */
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include "tools/index2.hpp"
+#include "tools/index3.hpp"
+namespace cha
+{
+
+
+
+/// @brief 图块的对称性，决定由一个基础图块派生出的变体
+/// @details 变体按下列顺序生成（flipX 为左右镜像，flipY 为上下镜像，rot 为顺时针旋转 90 度）
+///          - `X` 各向对称：{id}
+///          - `I` 直线型：{id, rot}
+///          - `L` 拐角型：{id, flipX, flipY, flipXY}
+///          - `T` 丁字型：{id, rot, rot², rot³}
+///          - `N` 无对称：{id, rot, rot², rot³, flipX, flipX·rot, flipX·rot², flipX·rot³}
+enum class Symmetry : std::uint8_t
+{
+    X, I, L, T, N
+};
+
+
+
+/// @brief 规则中的一个基础图块
+/// @note `sockets` 的顺序与 `DIR4` 一致：上、左、右、下
+///       相邻两格兼容当且仅当相对的两条边接口编号相等
+struct TileRule
+{
+    std::array<int, 4> sockets{};
+    Symmetry symmetry = Symmetry::X;
+    int weight = 1;
+};
+
+
+
+/// @brief 三维规则中的一个基础图块
+/// @note `sockets` 的顺序与 `DIR6` 一致：-z、上、左、右、下、+z
+///       其中水平方向的四个面（下标 1 ~ 4）参与对称变换
+struct TileRule3
+{
+    std::array<int, 6> sockets{};
+    Symmetry symmetry = Symmetry::X;
+    int weight = 1;
+};
+
+
+
+/// @brief 编译生成的邻接兼容表
+/// @tparam `K` 展开变体后的图块数量
+/// @tparam `D` 方向数量，4 对应 `DIR4`，6 对应 `DIR6`
+template <std::size_t K, std::size_t D = 4>
+struct AdjacencyTable
+{
+    static_assert(K > 0 && K <= 32, "AdjacencyTable supports at most 32 tiles");
+    static_assert(D == 4 || D == 6, "AdjacencyTable supports DIR4 or DIR6");
+
+    /// @brief `support[d][t]` 为图块 `t` 在方向 `dir(d)` 上允许的邻居集合
+    std::array<std::array<std::uint32_t, K>, D> support{};
+    /// @brief 每个变体的权重
+    std::array<int, K> weights{};
+    /// @brief 每个变体对应的基础图块下标
+    std::array<int, K> base{};
+    /// @brief 每个变体的接口，便于调试与渲染
+    std::array<std::array<int, D>, K> sockets{};
+
+    [[nodiscard]] static constexpr std::size_t size() noexcept {
+        return K;
+    }
+
+    [[nodiscard]] static constexpr std::size_t dirCount() noexcept {
+        return D;
+    }
+
+    [[nodiscard]] static constexpr Int3 dir(std::size_t d) noexcept {
+        if constexpr (D == 4) return DIR4[d];
+        else return DIR6[d];
+    }
+};
+
+
+
+namespace rule_detail
+{
+
+constexpr std::array<int, 4> flipX(const std::array<int, 4>& s) noexcept {
+    return {s[0], s[2], s[1], s[3]};
+}
+
+constexpr std::array<int, 4> flipY(const std::array<int, 4>& s) noexcept {
+    return {s[3], s[1], s[2], s[0]};
+}
+
+constexpr std::array<int, 4> rotate(const std::array<int, 4>& s) noexcept {
+    return {s[1], s[3], s[0], s[2]};
+}
+
+constexpr std::size_t variantCount(Symmetry sym) noexcept {
+    switch (sym) {
+    case Symmetry::X: return 1;
+    case Symmetry::I: return 2;
+    case Symmetry::L: return 4;
+    case Symmetry::T: return 4;
+    case Symmetry::N: return 8;
+    }
+    return 1;
+}
+
+/// @brief 对水平方向的四个接口生成第 `i` 个变体
+constexpr std::array<int, 4> variant(std::array<int, 4> s, Symmetry symmetry, std::size_t i) noexcept {
+    if (symmetry == Symmetry::L) {
+        if (i & 1u) s = flipX(s);
+        if (i & 2u) s = flipY(s);
+        return s;
+    }
+    if (i >= 4) {
+        s = flipX(s);
+        i -= 4;
+    }
+    while (i--) s = rotate(s);
+    return s;
+}
+
+constexpr std::array<int, 4> variant(const TileRule& tile, std::size_t i) noexcept {
+    return variant(tile.sockets, tile.symmetry, i);
+}
+
+constexpr std::array<int, 6> variant(const TileRule3& tile, std::size_t i) noexcept {
+    const auto& s = tile.sockets;
+    const auto h = variant(std::array<int, 4>{s[1], s[2], s[3], s[4]}, tile.symmetry, i);
+    return {s[0], h[0], h[1], h[2], h[3], s[5]};
+}
+
+} // namespace rule_detail
+
+
+
+/// @brief 计算一组图块展开后的变体总数
+template <typename Tile, std::size_t N>
+[[nodiscard]] constexpr std::size_t variantCount(const std::array<Tile, N>& tiles) noexcept {
+    std::size_t res = 0;
+    for (const auto& tile : tiles) res += rule_detail::variantCount(tile.symmetry);
+    return res;
+}
+
+
+
+/// @brief 在编译期由图块描述生成邻接兼容表
+/// @tparam `Tiles` 具有静态存储期的 `std::array<TileRule, N>` 或 `std::array<TileRule3, N>` 常量
+/// @return `AdjacencyTable`，变体按基础图块顺序依次展开
+/// @code
+///     inline constexpr std::array PIPE_TILES{
+///         cha::TileRule{{0, 0, 1, 1}, cha::Symmetry::L},
+///         cha::TileRule{{0, 0, 0, 0}, cha::Symmetry::X},
+///     };
+///     constexpr auto PIPE_RULE = cha::compileRule<PIPE_TILES>();
+/// @endcode
+template <const auto& Tiles>
+[[nodiscard]] constexpr auto compileRule() noexcept {
+    constexpr std::size_t K = variantCount(Tiles);
+    constexpr std::size_t D = Tiles[0].sockets.size();
+    AdjacencyTable<K, D> res{};
+    std::size_t k = 0;
+    for (std::size_t i = 0; i < Tiles.size(); ++i) {
+        for (std::size_t v = 0; v < rule_detail::variantCount(Tiles[i].symmetry); ++v, ++k) {
+            res.sockets[k] = rule_detail::variant(Tiles[i], v);
+            res.weights[k] = Tiles[i].weight;
+            res.base[k] = static_cast<int>(i);
+        }
+    }
+    for (std::size_t d = 0; d < D; ++d) {
+        for (std::size_t a = 0; a < K; ++a) {
+            for (std::size_t b = 0; b < K; ++b) {
+                if (res.sockets[a][d] == res.sockets[b][D - 1 - d]) {
+                    res.support[d][a] |= std::uint32_t{1} << b;
+                }
+            }
+        }
+    }
+    return res;
+}
+
+
+
+} // namespace cha
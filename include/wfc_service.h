@@ -0,0 +1,125 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "tools/index2.hpp"
+#include "wfc.h"
+#include "wfc_cache.h"
+#include "wfc_pool.h"
+#include "wfc_rule.hpp"
+namespace cha
+{
+
+
+
+/// @brief 常驻的生成服务：规则与已初始化的求解器常驻内存，请求分发到工作线程并行求解
+/// @details 请求为一行文本：
+///          `<id> <规则名> <行数> <列数> <种子> [<y> <x> <掩码>]...`
+///          其中每个三元组为一个预设，掩码为允许的图块集合（十进制）。
+///          响应为二进制帧，所有整数均为小端序：
+///          `uint32 id, uint32 status, uint32 行数, uint32 列数, uint8 图块[行数 * 列数]`
+///          图块按行优先排列，未决定的格子为 255；status 见 `Status`，失败时行数与列数仍为请求的尺寸，图块部分为空。
+///          响应按完成的顺序写出，以 id 与请求对应。
+///          同时求解的请求数量有上限，达到上限时暂停读取请求，直到有请求完成。
+class GenerationService
+{
+public:
+    using BitsetType = WaveFunctionCollapse::BitsetType;
+
+    enum class Status : std::uint32_t
+    {
+        Ok = 0,
+        BadRequest = 1,     // 无法解析、规则名未登记或格子数量超出上限
+        Contradiction = 2,  // 预设之间互相矛盾
+        Failed = 3,         // 在回溯次数的限制内没有找到解
+    };
+
+    struct Request
+    {
+        std::uint32_t id = 0;
+        std::string rule;
+        Int2 size;
+        std::uint32_t seed = 0;
+        std::vector<std::pair<Int2, BitsetType>> presets;
+    };
+
+    struct Response
+    {
+        std::uint32_t id = 0;
+        Status status = Status::BadRequest;
+        Int2 size;
+        std::vector<std::uint8_t> tiles;
+    };
+
+    /// @brief 构造函数
+    /// @param threads 工作线程数量，为 0 时取硬件并发数
+    explicit GenerationService(std::size_t threads = 0)
+        : threads_(threads) {}
+
+    /// @brief 以名字登记一种规则
+    /// @details 登记时以 1×1 的求解器执行一次设置方法并记下规则哈希，作为缓存的键；
+    ///          规则哈希为 0（函数形式的规则或自定义拓扑）的规则不使用缓存
+    void addRule(std::string name, SolverPool::SetupType setup);
+
+    /// @brief 以名字登记编译期生成的邻接兼容表，使用 `MRV` 选择策略
+    template <std::size_t K>
+    void addRule(std::string name, const AdjacencyTable<K, 4>& rule) {
+        addRule(std::move(name), [rule](WaveFunctionCollapse& wfc) {
+            wfc.setRule(rule);
+            wfc.setHeuristic(WaveFunctionCollapse::Heuristic::MRV);
+        });
+    }
+
+    /// @brief 设置每个请求的格子数量上限，默认为 2^22，超出时返回 `BadRequest`
+    void setMaxCells(std::size_t cells) noexcept {
+        max_cells_ = cells;
+    }
+
+    /// @brief 设置同时求解（已读取而尚未写出响应）的请求数量上限，为 0 时取工作线程数量的 4 倍
+    void setMaxPending(std::size_t requests) noexcept {
+        max_pending_ = requests;
+    }
+
+    /// @brief 设置结果缓存，命中时不再求解；为空指针时不使用缓存
+    /// @note 缓存需要比服务存活得更久
+    void setCache(MapCache* cache) noexcept {
+        cache_ = cache;
+    }
+
+    /// @brief 解析一行请求
+    /// @return 格式错误时返回 false
+    static bool parse(std::string_view line, Request& request);
+
+    /// @brief 在调用线程中处理一个请求
+    Response handle(const Request& request);
+
+    /// @brief 写出一个响应帧
+    static void write(std::ostream& out, const Response& response);
+
+    /// @brief 从 `in` 逐行读取请求直到结束，并行求解后把响应写入 `out`，返回前等待所有请求完成
+    /// @details 请求数量达到 `setMaxPending()` 的上限时等待，不会无限地积压在任务队列中
+    void run(std::istream& in, std::ostream& out);
+
+private:
+    struct RuleEntry
+    {
+        int id;
+        std::uint64_t hash;
+    };
+
+    std::size_t threads_;
+    std::size_t max_cells_ = std::size_t(1) << 22;
+    std::size_t max_pending_ = 0;
+    SolverPool pool_;
+    MapCache* cache_ = nullptr;
+    std::map<std::string, RuleEntry, std::less<>> rules_;
+};
+
+
+
+} // namespace cha
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+namespace cha::simd
+{
+
+
+
+/// @brief 对一整行格子施加同一方向的约束
+/// @param `dst` 被约束的格子，`dst[i] &= valid(src[i])`
+/// @param `src` 约束来源的格子
+/// @param `n` 格子数量
+/// @param `support` `support[t]` 为图块 `t` 在该方向上允许的邻居集合
+/// @param `count` 图块数量（不超过 32）
+/// @param `changed` 输出发生变化的下标，容量至少为 `n`
+/// @param `old` 输出发生变化的格子的旧值，容量至少为 `n`
+/// @return 发生变化的格子数量
+/// @details 运行时根据 CPU 支持选择 AVX-512 / AVX2 / 标量实现
+std::size_t narrow(std::uint32_t* dst, const std::uint32_t* src, std::size_t n,
+                   const std::uint32_t* support, int count,
+                   int* changed, std::uint32_t* old) noexcept;
+
+/// @brief 当前选用的指令集名称
+const char* isa() noexcept;
+
+
+
+} // namespace cha::simd
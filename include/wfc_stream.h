@@ -0,0 +1,104 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <span>
+#include <vector>
+#include "tools/mapped_matrix.hpp"
+#include "wfc.h"
+#include "wfc_rule.hpp"
+namespace cha
+{
+
+
+
+/// @brief 宽度固定、高度不限的地图的流式生成，只在内存中保留一个滑动窗口
+/// @details 窗口为 `window` 行，每次按扫描线顺序求解整个窗口，输出其中前 `commit` 行后向下滑动：
+///          下一个窗口的第一行固定为上一次输出的最后一行，其余各行重新求解。
+///          窗口中输出行之后的行不输出，只用来保证输出的行还能继续向下延伸，即回溯的范围。
+///          输出的行不再修改，窗口失败时只能换种子重试；所有窗口共用一个求解器，内存为 O(宽度 × 窗口)。
+///          细图块的规则只支持 `DIR4`。
+class StripStream
+{
+public:
+    using FactorType = WaveFunctionCollapse::FactorType;
+    using BitsetType = WaveFunctionCollapse::BitsetType;
+    using WeightType = WaveFunctionCollapse::WeightType;
+
+    /// @brief 接收输出的行 (行号, 每个格子的图块)，返回 false 时停止生成；`tiles` 只在调用期间有效
+    using SinkType = std::function<bool(std::int64_t row, std::span<const FactorType> tiles)>;
+
+    /// @brief 构造函数
+    /// @param width 地图宽度
+    /// @param rule 细图块的规则
+    /// @param seed 随机种子
+    template <std::size_t K>
+    StripStream(int width, const AdjacencyTable<K, 4>& rule, std::uint32_t seed = 0)
+        : StripStream(width, std::vector<BitsetType>(4 * K), std::vector<WeightType>(rule.weights.begin(), rule.weights.end()), seed) {
+        for (std::size_t d = 0; d < 4; ++d) {
+            for (std::size_t t = 0; t < K; ++t) {
+                support_[d * K + t] = rule.support[d][t];
+            }
+        }
+    }
+
+    /// @brief 构造函数
+    /// @param support `support[d * 图块数量 + t]` 为图块 `t` 在方向 `DIR4[d]` 上允许的邻居集合
+    /// @param weights 每个图块的权重
+    StripStream(int width, std::vector<BitsetType> support, std::vector<WeightType> weights, std::uint32_t seed = 0);
+
+    /// @brief 设置窗口的行数与每次输出的行数，需要 1 <= `commit` < `window`，默认为 32 与 16
+    /// @details 两者之差越大越不容易在输出之后陷入无解，但每行的求解次数也越多；
+    ///          不满足要求时 `generate` 不输出任何行并返回 false
+    void setWindow(int window, int commit) noexcept {
+        window_ = window;
+        commit_ = commit;
+    }
+
+    /// @brief 设置每个窗口换种子重试的次数，默认为 8
+    void setRetries(int retries) noexcept {
+        retries_ = retries;
+    }
+
+    /// @brief 逐行生成并交给 `sink`
+    /// @param rows 生成的行数，默认不限，直到 `sink` 返回 false
+    /// @return 生成了全部的行或被 `sink` 停止时返回 true，某个窗口重试后仍然无解时返回 false
+    bool generate(const SinkType& sink, std::int64_t rows = std::numeric_limits<std::int64_t>::max());
+
+    /// @brief 生成 `out.rows()` 行，写入以文件为存储的数组
+    /// @details 按行顺序写入，每写完一条块带即交给系统写回并释放，常驻内存与地图高度无关，
+    ///          生成结束时文件即为结果；`out` 需要可写且列数等于地图宽度，否则返回 false
+    bool generate(MappedMatrix<std::uint8_t>& out);
+
+    int getWidth() const noexcept {
+        return width_;
+    }
+
+    /// @brief 最近一次 `generate` 输出的行数
+    std::int64_t getRows() const noexcept {
+        return rows_;
+    }
+
+    /// @brief 最近一次 `generate` 中窗口重试的总次数
+    std::size_t getRetries() const noexcept {
+        return retried_;
+    }
+
+private:
+    int width_;
+    std::uint32_t seed_;
+    std::vector<BitsetType> support_;
+    std::vector<WeightType> weights_;
+    int window_ = 32;
+    int commit_ = 16;
+    int retries_ = 8;
+
+    std::int64_t rows_ = 0;
+    std::size_t retried_ = 0;
+
+    std::uint32_t seedOf_(std::int64_t strip, std::uint32_t salt) const noexcept;
+};
+
+
+
+} // namespace cha
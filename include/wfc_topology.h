@@ -0,0 +1,146 @@
+#pragma once
+#include <climits>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "tools/index3.hpp"
+namespace cha
+{
+
+
+
+/// @brief 六边形网格（轴向坐标，按平行四边形排列）的六个方向，第 d 个方向的反方向为第 5 - d 个
+/// @note 坐标为 {0, r, q}，与 `Topology::hex` 的标签顺序一致
+inline constexpr Int3 HEX6[6] = {
+    {0,-1, 0}, {0,-1, 1},
+    {0, 0,-1}, {0, 0, 1},
+    {0, 1,-1}, {0, 1, 0}
+};
+
+
+
+/// @brief 格子之间的邻接关系
+/// @details 每条边带有一个方向标签，传播时以标签查找规则中对应方向的兼容表。
+///          任意图以压缩行（CSR）形式预先展开，格子 `i` 的邻居为 `targets[offsets[i] .. offsets[i + 1])`；
+///          网格类拓扑（有界、环面、六边形）为每一行、每种列（靠近左右边界的几列各为一种，其余的列为一种）
+///          预先计算各方向上邻居的偏移，越界与环面的回绕都已算入表中，遍历时只需一次除法求出行号，
+///          内存占用与行数成正比。
+///          网格类拓扑的格子编号与 `Matrix3` 的存储位置一致。
+class Topology
+{
+public:
+    /// @brief 一条有向边，`label` 为规则中的方向下标
+    struct Link
+    {
+        int from;
+        int to;
+        std::uint8_t label;
+    };
+
+    Topology() = default;
+
+    /// @brief 有界的矩形（长方体）网格
+    /// @param size {层数, 行数, 列数}
+    /// @param dirs 邻域，第 d 个方向的标签为 d
+    static Topology grid(Int3 size, std::span<const Int3> dirs);
+
+    /// @brief 首尾相接（环面）的网格，越过边界的邻居取模回绕
+    static Topology wrap(Int3 size, std::span<const Int3> dirs);
+
+    /// @brief 二维邻域（如 `DIR4`、`DIR8`）的版本，z 方向的位移取 0
+    static Topology grid(Int3 size, std::span<const Int2> dirs);
+    static Topology wrap(Int3 size, std::span<const Int2> dirs);
+
+    /// @brief 六边形网格，标签顺序见 `HEX6`
+    /// @param rows 行数
+    /// @param cols 列数
+    static Topology hex(int rows, int cols);
+
+    /// @brief 任意图
+    /// @param count 格子数量，格子 i 位于 {0, 0, i}
+    /// @param links 所有有向边，无向的连接需要分别给出两个方向
+    /// @param dirs 每个标签对应的位移，仅供函数形式的规则使用，可以为空
+    static Topology graph(int count, std::span<const Link> links, std::vector<Int3> dirs = {});
+
+    /// @brief 格子排布的尺寸，任意图为 {1, 1, 格子数量}
+    Int3 size() const noexcept {
+        return size_;
+    }
+
+    int cellCount() const noexcept {
+        return size_.z * size_.y * size_.x;
+    }
+
+    int labelCount() const noexcept {
+        return label_count_;
+    }
+
+    /// @brief 标签对应的位移，没有给出时为 {0, 0, 0}
+    Int3 dir(int label) const noexcept {
+        return std::size_t(label) < dirs_.size() ? dirs_[label] : Int3{};
+    }
+
+    const std::vector<Int3>& dirs() const noexcept {
+        return dirs_;
+    }
+
+    /// @brief 是否为 `grid` 构造的有界网格，只有这种拓扑可以按行扫描传播
+    bool isGrid() const noexcept {
+        return grid_;
+    }
+
+    /// @brief 占用的堆内存（字节）
+    std::size_t bytes() const noexcept {
+        return dirs_.capacity() * sizeof(Int3) + row_delta_.capacity() * sizeof(int) + offsets_.capacity() * sizeof(int)
+            + targets_.capacity() * sizeof(int) + labels_.capacity() * sizeof(std::uint8_t);
+    }
+
+    /// @brief 对格子 `idx` 的每个邻居调用 `visit(target, label)`
+    /// @return `visit` 返回 false 时立即停止并返回 false
+    template <typename Visit>
+    bool visit(int idx, Visit&& visit) const {
+        if (!lattice_) {
+            for (int e = offsets_[idx]; e < offsets_[idx + 1]; ++e) {
+                if (!visit(targets_[e], int(labels_[e]))) return false;
+            }
+            return true;
+        }
+        const int cols = size_.x;
+        const int row = idx / cols;
+        const int x = idx - row * cols;
+        const int kind = x < col_edge_ ? x : x < cols - col_edge_ ? col_edge_ : x - cols + 2 * col_edge_ + 1;
+        const int count = static_cast<int>(dirs_.size());
+        const int* delta = &row_delta_[(std::size_t(row) * col_kinds_ + kind) * count];
+        for (int d = 0; d < count; ++d) {
+            if (delta[d] == NONE) continue;
+            if (!visit(idx + delta[d], d)) return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr int NONE = INT_MIN;
+
+    Int3 size_{};
+    int label_count_ = 0;
+    bool grid_ = false;
+    bool lattice_ = false;
+    std::vector<Int3> dirs_;
+
+    // 网格：左右各 col_edge_ 列单独成一种列，共 col_kinds_ 种；
+    // row_delta_[(r * col_kinds_ + kind) * dirs_.size() + d] 为存储中第 r 行这种列的格子沿方向 d 到邻居的偏移，没有邻居时为 NONE
+    int col_edge_ = 0;
+    int col_kinds_ = 1;
+    std::vector<int> row_delta_;
+
+    // 任意图
+    std::vector<int> offsets_{0};
+    std::vector<int> targets_;
+    std::vector<std::uint8_t> labels_;
+
+    static Topology lattice(Int3 size, std::span<const Int3> dirs, bool wrap);
+};
+
+
+
+} // namespace cha
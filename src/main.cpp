@@ -1,15 +1,26 @@
+#include <chrono>
 #include <SFML/System/Clock.hpp>
 #include <SFML/System/Vector2.hpp>
 #include <SFML/Graphics.hpp>
 #include <fmt/core.h>
 #include "wfc.h"
 #include "renderer.h"
+#include "wfc_rule.hpp"
 #include "tools/index2.hpp"
 constexpr bool ASYNC_ON = true;
 constexpr sf::Vector2u TILE_SIZE{16u, 16u};
 constexpr sf::Vector2u MAP_SIZE{64u, 64u};
 constexpr sf::Vector2u SCREEN_SIZE{TILE_SIZE.x * MAP_SIZE.x, TILE_SIZE.y * MAP_SIZE.y};
 constexpr sf::Color BACKGROUND_COLOR(0, 0, 0);
+// 每帧用于求解的时间
+constexpr std::chrono::milliseconds SOLVE_TIME{4};
+
+// 管道图块：接口 0 为封闭，1 为管道开口；拐角 ┌ 经镜像得到 ┐ └ ┘，与贴图顺序一致
+inline constexpr std::array PIPE_TILES{
+    cha::TileRule{{0, 0, 1, 1}, cha::Symmetry::L},
+    cha::TileRule{{0, 0, 0, 0}, cha::Symmetry::X},
+};
+constexpr auto PIPE_RULE = cha::compileRule<PIPE_TILES>();
 
 int map[MAP_SIZE.x * MAP_SIZE.y];
 cha::WaveFunctionCollapse wfc(MAP_SIZE.y, MAP_SIZE.x);
@@ -20,10 +31,7 @@ bool stop;
 
 bool init();
 void handle_event(std::optional<sf::Event> event, sf::RenderWindow& window);
-cha::Generator<std::pair<cha::Int2, int>>& get_gen() {
-    static auto gen = wfc.generate_async();
-    return gen;
-}
+void update_tiles();
 
 
 
@@ -41,24 +49,16 @@ int main()
         return -1;
     }
 
-    sf::Clock clock;
-    sf::Time timer;
-    constexpr sf::Time FRAME_TIME = sf::milliseconds(3);
-
     while (window.isOpen()) {
         while (const std::optional event = window.pollEvent()) {
             handle_event(event, window);
         }
         if (!window.hasFocus()) continue;
         if constexpr (ASYNC_ON) {
-            timer += clock.restart();
-            while (timer > FRAME_TIME) {
-                timer -= FRAME_TIME;
-                if (stop) continue;
-                if (const auto result = get_gen().next()) [[likely]] {
-                    const auto [pos, id] = *result;
-                    render.setTile({unsigned(pos.x), unsigned(pos.y)}, id);
-                }
+            const auto status = wfc.getStatus();
+            if (!stop && (status == cha::WaveFunctionCollapse::Status::Idle || status == cha::WaveFunctionCollapse::Status::Running)) {
+                wfc.run_for(std::chrono::steady_clock::now() + SOLVE_TIME);
+                update_tiles();
             }
         }
         window.clear(BACKGROUND_COLOR);
@@ -71,40 +71,7 @@ int main()
 
 bool init()
 {
-    wfc.getWeights() = {
-        1, 1, 1, 1, 1
-    };
-    wfc.getDiffuseFuncs().emplace_back(
-        std::vector(cha::DIR4, cha::DIR4 + 4),
-        [](auto bitset, auto dir) {
-            cha::WaveFunctionCollapse::BitsetType res;
-            if (dir.y) {
-                res = (bitset & 1u) << 2
-                    | (bitset & 2u) << 1
-                    | (bitset & 4u) >> 2
-                    | (bitset & 8u) >> 3;
-                res *= 3;
-            } else {
-                res = (bitset & 1u) << 1
-                    | (bitset & 2u) >> 1
-                    | (bitset & 4u) >> 1
-                    | (bitset & 8u) >> 3;
-                res *= 5;
-            }
-            if (dir.y < 0) res |= !!(bitset & 0b0011u) << 4; else {
-            if (dir.y > 0) res |= !!(bitset & 0b1100u) << 4; else {
-            if (dir.x < 0) res |= !!(bitset & 0b0101u) << 4; else {
-            if (dir.x > 0) res |= !!(bitset & 0b1010u) << 4; }}}
-            if (bitset & 16u) {
-                if (dir.y < 0) res |= 0b1100u; else {
-                if (dir.y > 0) res |= 0b0011u; else {
-                if (dir.x < 0) res |= 0b1010u; else {
-                if (dir.x > 0) res |= 0b0101u; }}}
-                res |= 16u;
-            }
-            return res;
-        }
-    );
+    wfc.setRule(PIPE_RULE);
 
     wfc.init();
     if constexpr (ASYNC_ON) {
@@ -145,6 +112,21 @@ bool init()
 
 
 
+/*
+ * 按求解器的当前状态刷新所有格子，未决定的格子显示为空
+ */
+void update_tiles()
+{
+    for (unsigned y = 0; y < MAP_SIZE.y; ++y) {
+        for (unsigned x = 0; x < MAP_SIZE.x; ++x) {
+            const int v = cha::WaveFunctionCollapse::toFactor(wfc.get({int(y), int(x)}));
+            render.setTile({x, y}, (v + 6) % 6);
+        }
+    }
+}
+
+
+
 void handle_event(std::optional<sf::Event> event, sf::RenderWindow& window)
 {
     static float factor = 1.f;
@@ -0,0 +1,69 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <fmt/core.h>
+#include "wfc_rule.hpp"
+#include "wfc_service.h"
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// 管道图块：接口 0 为封闭，1 为管道开口
+inline constexpr std::array PIPE_TILES{
+    cha::TileRule{{0, 0, 1, 1}, cha::Symmetry::L},
+    cha::TileRule{{0, 0, 0, 0}, cha::Symmetry::X},
+};
+
+// 完整的管道图块：拐角、直线、丁字、十字与空白
+inline constexpr std::array PIPE_FULL_TILES{
+    cha::TileRule{{0, 0, 1, 1}, cha::Symmetry::L, 2},
+    cha::TileRule{{1, 0, 0, 1}, cha::Symmetry::I, 2},
+    cha::TileRule{{1, 1, 1, 0}, cha::Symmetry::T},
+    cha::TileRule{{1, 1, 1, 1}},
+    cha::TileRule{{0, 0, 0, 0}, cha::Symmetry::X, 4},
+};
+
+
+
+/*
+ * 生成服务：从标准输入逐行读取请求，向标准输出写出二进制响应帧，格式见 GenerationService
+ * 用法：service [-j 线程数] [-c 缓存文件]
+ */
+int main(int argc, char** argv)
+{
+    std::size_t threads = 0;
+    const char* cache_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = std::strtoul(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            cache_path = argv[++i];
+        } else {
+            fmt::print(stderr, "usage: {} [-j threads] [-c cache]\n", argv[0]);
+            return 1;
+        }
+    }
+
+#ifdef _WIN32
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    std::ios::sync_with_stdio(false);
+
+    cha::GenerationService service(threads);
+    service.addRule("pipe", cha::compileRule<PIPE_TILES>());
+    service.addRule("pipe_full", cha::compileRule<PIPE_FULL_TILES>());
+    std::unique_ptr<cha::MapCache> cache;
+    if (cache_path) {
+        cache = std::make_unique<cha::MapCache>(cache_path);
+        if (!cache->isOpen()) {
+            fmt::print(stderr, "cannot open cache {} (not writable, or not a cache file)\n", cache_path);
+            return 1;
+        }
+        service.setCache(cache.get());
+    }
+    service.run(std::cin, std::cout);
+    return 0;
+}
@@ -1,15 +1,26 @@
 #include "wfc.h"
-#include <queue>
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <limits>
 #include <fmt/core.h>
-#include "tools/binary_indexed_tree.hpp"
+#include "tools/fnv_hash.hpp"
 #include "tools/generator.hpp"
 #include "tools/index2.hpp"
+#include "tools/index3.hpp"
+#include "tools/thread_pool.hpp"
+#include "wfc_global.h"
+#include "wfc_simd.h"
 namespace cha
 {
 
 
 
+// 并行传播时一层至少有这么多格子才拆分到线程池，较小的一层分发的开销高于收益
+static constexpr std::size_t PARALLEL_LAYER = 2048;
+
+
+
 double WaveFunctionCollapse::Node::getEntropy(const WaveFunctionCollapse& wfc) const
 {
     double res = 0.0;
@@ -30,202 +41,828 @@ double WaveFunctionCollapse::Node::getEntropy(const WaveFunctionCollapse& wfc) c
 
 
 
-std::vector<WaveFunctionCollapse::FactorType> WaveFunctionCollapse::Node::collapse(const WaveFunctionCollapse& wfc) const
+/*
+ * 按权重随机选取一个可能的图块
+ * 依次选取并排除已失败的图块，与按权重打乱后依次尝试等价
+ */
+WaveFunctionCollapse::FactorType WaveFunctionCollapse::Node::pick(const WaveFunctionCollapse& wfc) const
 {
-    static std::vector<FactorType> tmp(wfc.getFactorCount());
-    int num = 0;
-    for (FactorType i = 0; i < wfc.getFactorCount(); ++i) {
-        if (bitset >> i & 1u) {
-            tmp[num++] = i;
-        }
+    WeightType total{};
+    for (BitsetType b = bitset; b; b &= b - 1) {
+        total += wfc.weights_[std::countr_zero(b)];
     }
-    auto func = [&wfc](int i) {
-        return wfc.weights_[tmp[i]];
-    };
-    std::vector<int> idx(num);
-    std::iota(idx.begin(), idx.end(), 0);
-    cha::BinaryIndexedTree<WeightType> bit(num, func);
-    for (int i = num; ~--i;) {
-        std::uniform_int_distribution<int> dist(1, bit.get(i + 1));
-        const int j = bit.lower(dist(*wfc.gen_ptr_), i + 1);
-        bit.add(j + 1, func(idx[i]) - func(idx[j]));
-        std::swap(idx[i], idx[j]);
+    if (total <= 0) {
+        return std::countr_zero(bitset);
     }
-    std::reverse(idx.begin(), idx.end());
-
-    std::vector<FactorType> res(num);
-    for (int i = 0; i < num; ++i) {
-        res[i] = tmp[idx[i]];
+    std::uniform_int_distribution<WeightType> dist(1, total);
+    WeightType r = dist(*wfc.gen_ptr_);
+    for (BitsetType b = bitset; b; b &= b - 1) {
+        const FactorType i = std::countr_zero(b);
+        if ((r -= wfc.weights_[i]) <= 0) {
+            return i;
+        }
     }
-    return res;
+    return std::countr_zero(bitset);
 }
 
 
 
-    
-static std::minstd_rand& get_gen_instance() {
-    static std::minstd_rand gen(std::random_device{}());
-    return gen;
-}
-
 WaveFunctionCollapse::WaveFunctionCollapse(int height, int width, std::minstd_rand* gen_ptr)
-    : gen_ptr_(gen_ptr), size_(height, width), mat_(height, width), vis_(height, width, false)
+    : WaveFunctionCollapse(Int3(1, height, width), gen_ptr) {}
+
+
+
+WaveFunctionCollapse::WaveFunctionCollapse(Int3 size, std::minstd_rand* gen_ptr)
+    : gen_ptr_(gen_ptr), size_(size)
 {
     if (gen_ptr_ == nullptr) {
-        gen_ptr_ = &get_gen_instance();
+        gen_.seed(std::random_device{}());
+        gen_ptr_ = &gen_;
     }
 }
 
 
 
+WaveFunctionCollapse::WaveFunctionCollapse(Topology topology, std::minstd_rand* gen_ptr)
+    : WaveFunctionCollapse(topology.size(), gen_ptr)
+{
+    setTopology(std::move(topology));
+}
+
+
+
+void WaveFunctionCollapse::setTopology(Topology topology)
+{
+    topology_ = std::move(topology);
+    custom_topology_ = true;
+    size_ = topology_.size();
+}
+
+
+
 bool WaveFunctionCollapse::init()
 {
-    if (getFactorCount() == 0) {
+    if (getFactorCount() == 0 || !buildTopology_()) {
         return false;
     }
-    mat_.fill(Node(getFactorMask()));
-    for (const Int2 pos : Int2::Range(size_)) {
-        todo_set_.insert(pos);
+
+    // 选用能容纳全部图块的最窄存储，尺寸与类型不变时复用
+    auto fill = [this]<typename T>(std::type_identity<T>) {
+        const T mask = static_cast<T>(getFactorMask());
+        if (auto* cells = std::get_if<Matrix3<T>>(&mat_); cells && cells->size() == size_) {
+            cells->fill(mask);
+        } else {
+            mat_.emplace<Matrix3<T>>(size_, mask);
+        }
+    };
+    if (getFactorCount() <= 8) fill(std::type_identity<std::uint8_t>{});
+    else if (getFactorCount() <= 16) fill(std::type_identity<std::uint16_t>{});
+    else fill(std::type_identity<std::uint32_t>{});
+    if (vis_.size() != size_) {
+        vis_ = Matrix3<std::uint8_t>(size_, 0);
     }
-    return true;
+
+    const std::size_t length = vis_.length();
+    todo_.resize(length);
+    todo_pos_.resize(length);
+    std::iota(todo_.begin(), todo_.end(), 0);
+    std::iota(todo_pos_.begin(), todo_pos_.end(), 0);
+    backup_.clear();
+    notified_ = 0;
+    find_mode_ = Heuristic::Entropy;
+    status_ = Status::Idle;
+
+    // 展开 sweep 的所有方向，对于函数形式的规则记录对应的影响算法
+    sweep_dirs_.clear();
+    if (!rule_dirs_.empty()) {
+        for (const Int3 dp : rule_dirs_) sweep_dirs_.emplace_back(dp, nullptr);
+    } else {
+        for (const auto& [group, func] : diffuse_funcs_) {
+            for (const Int3 dp : group) sweep_dirs_.emplace_back(dp, &func);
+        }
+    }
+
+    // 预先分配求解过程中按尺寸确定的辅助内存，之后的求解循环不再分配
+    // states_ 与 backup_ 的长度取决于搜索深度，不按尺寸预留，随搜索按倍数增长，reset() 之后保留容量
+    const std::size_t rows = std::size_t(size_.z) * size_.y;
+    sweep_dirty_.assign(rows, 0);
+    sweep_next_.assign(rows, 0);
+    sweep_changed_.resize(size_.x);
+    sweep_old_.resize(size_.x);
+    layer_.reserve(length);
+    next_layer_.reserve(length);
+    if (lookahead_ > 0) {
+        probe_.reserve(length);
+    }
+    if (propagation_ == Propagation::Parallel) {
+        par_mask_.assign(length, ~0u);
+    }
+    switch (heuristic_) {
+    case Heuristic::MRV:
+        bucket_head_.reserve(33);
+        bucket_next_.reserve(length);
+        bucket_prev_.reserve(length);
+        bucket_of_.reserve(length);
+        break;
+    case Heuristic::Hilbert:
+    case Heuristic::Spiral:
+        order_.reserve(length);
+        rank_.reserve(length);
+        break;
+    default:
+        break;
+    }
+    return analyze_();
+}
+
+
+
+void WaveFunctionCollapse::reset(std::uint32_t seed)
+{
+    gen_ptr_->seed(seed);
+    std::visit([this](auto& cells) {
+        cells.fill(static_cast<typename std::decay_t<decltype(cells)>::value_type>(getFactorMask()));
+    }, mat_);
+    todo_.resize(todo_pos_.size());
+    std::iota(todo_.begin(), todo_.end(), 0);
+    std::iota(todo_pos_.begin(), todo_pos_.end(), 0);
+    backup_.clear();
+    notified_ = 0;
+    states_.clear();
+    find_mode_ = Heuristic::Entropy;
+    status_ = Status::Idle;
+    contradiction_ = Int3(-1, -1, -1);
+    for (const auto& [idx, bitset] : initial_) {
+        store_(idx, bitset);
+    }
+}
+
+
+
+/*
+ * 以扫描的方式对所有格子做约束传播，直到不动点
+ * 用于大量预设之后的初始传播
+ */
+bool WaveFunctionCollapse::propagate()
+{
+    if (!topology_.isGrid()) {
+        std::vector<int> seeds(vis_.length());
+        std::iota(seeds.begin(), seeds.end(), 0);
+        return spread_(seeds, backup_.size());
+    }
+    const std::size_t mark = backup_.size();
+    std::fill(sweep_dirty_.begin(), sweep_dirty_.end(), 1);
+    const bool ok = sweep_(mark);
+    if (ok && find_mode_ == Heuristic::MRV) {
+        touch_(mark);
+    }
+    return ok;
+}
+
+
+
+WaveFunctionCollapse::BitsetType WaveFunctionCollapse::get(Int3 pos) const
+{
+    return load_(index_(pos));
 }
 
 
 
 WaveFunctionCollapse::BitsetType WaveFunctionCollapse::get(Int2 pos) const
 {
-    return mat_[pos].bitset;
+    return get(Int3(pos));
+}
+
+
+
+bool WaveFunctionCollapse::set(Int3 pos, BitsetType bitset)
+{
+    return diffuse_(static_cast<int>(index_(pos)), Node(bitset));
 }
 
 
 
 bool WaveFunctionCollapse::set(Int2 pos, BitsetType bitset)
 {
-    return diffuse_(pos, Node(bitset));
+    return set(Int3(pos), bitset);
+}
+
+
+
+/*
+ * 批量施加约束：先对所有格子取交集，再从发生变化的格子出发做一次传播
+ * 失败时撤销本次的全部修改
+ */
+bool WaveFunctionCollapse::set(std::span<const std::pair<Int3, BitsetType>> presets)
+{
+    const std::size_t mark = backup_.size();
+    std::vector<int> seeds;
+    seeds.reserve(presets.size());
+    for (const auto& [pos, bitset] : presets) {
+        const int idx = static_cast<int>(index_(pos));
+        const Node tmp(load_(idx));
+        const Node node(tmp.bitset & bitset);
+        if (node == tmp) continue;
+        store_(idx, node.bitset);
+        backup_.emplace_back(idx, tmp);
+        if (node.isEmpty()) [[unlikely]] {
+            contradiction_ = pos;
+            restore_(mark);
+            return false;
+        }
+        seeds.push_back(idx);
+    }
+    return seeds.empty() || spread_(seeds, mark);
+}
+
+
+
+bool WaveFunctionCollapse::set(std::span<const std::pair<Int2, BitsetType>> presets)
+{
+    std::vector<std::pair<Int3, BitsetType>> tmp(presets.begin(), presets.end());
+    return set(tmp);
+}
+
+
+
+bool WaveFunctionCollapse::set(const Matrix3<BitsetType>& masks)
+{
+    if (masks.size() != size_) {
+        return false;
+    }
+    std::vector<std::pair<Int3, BitsetType>> presets;
+    for (const Int3 pos : Int3::Range(size_)) {
+        if (const BitsetType bitset = masks[pos]; (bitset & getFactorMask()) != getFactorMask()) {
+            presets.emplace_back(pos, bitset);
+        }
+    }
+    return set(presets);
+}
+
+
+
+bool WaveFunctionCollapse::set(const Matrix<BitsetType>& masks)
+{
+    if (masks.rows() != std::size_t(size_.y) || masks.cols() != std::size_t(size_.x)) {
+        return false;
+    }
+    std::vector<std::pair<Int3, BitsetType>> presets;
+    for (const Int2 pos : Int2::Range(size_.yx())) {
+        if (const BitsetType bitset = masks[pos]; (bitset & getFactorMask()) != getFactorMask()) {
+            presets.emplace_back(pos, bitset);
+        }
+    }
+    return set(presets);
 }
 
 
 
 void WaveFunctionCollapse::backtrack()
 {
-    for (const auto [pos, node] : backup_) {
-        mat_[pos] = node;
+    restore_(0);
+    status_ = Status::Idle;
+}
+
+
+
+/*
+ * 分步求解：DFS 的搜索栈保存在 states_ 中，每次 advance_() 推进一步
+ * generate()、generate_async() 与 step() 共用同一个状态机，只是推进的方式不同
+ */
+WaveFunctionCollapse::Status WaveFunctionCollapse::step(std::size_t max_steps)
+{
+    if (status_ == Status::Idle) {
+        start_();
     }
-    backup_.clear();
+    for (; max_steps && status_ == Status::Running; --max_steps) {
+        advance_();
+    }
+    return status_;
+}
+
+
+
+WaveFunctionCollapse::Status WaveFunctionCollapse::run_for(std::chrono::steady_clock::time_point deadline)
+{
+    while (step() == Status::Running && std::chrono::steady_clock::now() < deadline) {}
+    return status_;
 }
 
 
 
 bool WaveFunctionCollapse::generate()
 {
-    // BFS
-    struct State {
-        Int2 pos;
-        std::vector<FactorType> factors;
-        int idx;
-        decltype(backup_) backup;
-    };
-    std::vector<State> states(size_.y * size_.x);
-    int top = -1;
-
-    auto create = [this, &states, &top] {
-        const Int2 pos = find_();
-        todo_set_.erase(pos);
-        ++top;
-        states[top].pos = pos;
-        states[top].factors = mat_[pos].collapse(*this);
-        states[top].idx = 0;
-        states[top].backup.clear();
-    };
+    if (status_ != Status::Running) {
+        status_ = Status::Idle;
+    }
+    return step(std::numeric_limits<std::size_t>::max()) == Status::Done;
+}
+
+
+
+bool WaveFunctionCollapse::solveWithin(std::size_t max_backtracks)
+{
+    if (status_ != Status::Running) {
+        status_ = Status::Idle;
+    }
+    while (step() == Status::Running && backtracks_ <= max_backtracks) {}
+    return status_ == Status::Done;
+}
+
+
+
+bool WaveFunctionCollapse::solveWithin()
+{
+    return solveWithin(4 * vis_.length());
+}
+
+
+
+Generator<std::pair<Int3, WaveFunctionCollapse::FactorType>> WaveFunctionCollapse::generate_async()
+{
+    // 每一步都恰好决定或撤销一个格子，开始时已经没有待决定的格子则直接结束
+    if (status_ != Status::Running) {
+        start_();
+    }
+    while (status_ == Status::Running) {
+        advance_();
+        co_yield getLastStep();
+    }
+}
+
+
+
+/*
+ * 近似求解分两步：
+ * 贪心坍缩时固定使用队列传播，每一步只撤销本步失败的尝试，撤销记录在每一步之后清空；
+ * 并行的分层传播不处理 approx_，approx_ 为真时 diffuse_impl_ 顺序处理每一层；
+ * 图块全部失败时打开 approx_，传播跳过会清空格子的约束并把该格子记入 conflicts_，
+ * 冲突的格子不再参与选择，仍随邻居收缩，全部决定之后才选取图块；
+ * 修复时按轮处理冲突的格子，layer_ 为本轮、next_layer_ 为下一轮，借用 vis_ 标记已加入的格子
+ */
+std::size_t WaveFunctionCollapse::generate_approx(std::size_t max_repairs)
+{
+    states_.clear();
+    backup_.clear();
+    backtracks_ = 0;
+    restarts_ = 0;
+    notified_ = 0;
+    conflicts_.clear();
+    const Heuristic heuristic = heuristic_;
+    if (heuristic_ == Heuristic::Entropy) {
+        heuristic_ = Heuristic::Scanline;
+    }
+    prepareFind_();
+    heuristic_ = heuristic;
 
-    bool ret = false;
-    create();
-    while (top >= 0) {
-        // fmt::print("stack size: {}\n", top + 1);
-        if (ret) --top;
-        else [[likely]] {
-            auto& [pos, factors, idx, backup] = states[top];
-            
-            // 复位
-            backup_.swap(backup);
-            backtrack();
-
-            if (idx == factors.size()) {
-                todo_set_.insert(pos);
-                --top;
-            } else [[likely]] {
-                const Node node(toBitset({factors[idx++]}));
-                if (!diffuse_(pos, node)) continue;
-                if (top == states.size() - 1) [[unlikely]] {
-                    --top;
-                    ret = true;
-                    continue;
+    while (!todo_.empty()) {
+        const int pos = find_();
+        todoErase_(pos);
+        const std::size_t first = conflicts_.size();
+        bool ok = false;
+        for (BitsetType rest = load_(pos); rest && !ok; ) {
+            const FactorType factor = Node(rest).pick(*this);
+            rest &= ~(1u << factor);
+            backup_.emplace_back(pos, Node(load_(pos)));
+            store_(pos, 1u << factor);
+            ok = spreadQueue_(std::span(&pos, 1), 0);
+            if (!ok) restore_(0);
+        }
+        if (!ok) {
+            // approx_ 下传播不会失败，否则 restore_ 会撤销这次强制的选择，而 pos 已经离开 todo_
+            approx_ = true;
+            backup_.emplace_back(pos, Node(load_(pos)));
+            store_(pos, 1u << Node(load_(pos)).pick(*this));
+            [[maybe_unused]] const bool forced = spreadQueue_(std::span(&pos, 1), 0);
+            assert(forced);
+            approx_ = false;
+        }
+        if (find_mode_ == Heuristic::MRV) {
+            touch_(0);
+        }
+        backup_.clear();
+        // 冲突的格子推迟到最后再决定，避免以不相容的图块继续约束邻居
+        for (std::size_t i = first; i < conflicts_.size(); ++i) {
+            if (todo_pos_[conflicts_[i]] >= 0) todoErase_(conflicts_[i]);
+        }
+    }
+    for (const int idx : conflicts_) {
+        store_(idx, 1u << Node(load_(idx)).pick(*this));
+    }
+
+    // 最小冲突：换成与邻居冲突最少的图块，相同时按权重随机选取；没有更好的图块时保持不变，交给冲突的邻居；
+    // 与之冲突的邻居进入下一轮
+    layer_.clear();
+    for (const int idx : conflicts_) {
+        if (!vis_[std::size_t(idx)]) {
+            vis_[std::size_t(idx)] = 1;
+            layer_.push_back(idx);
+        }
+    }
+    std::size_t repairs = 0;
+    while (!layer_.empty() && repairs < max_repairs) {
+        next_layer_.clear();
+        for (std::size_t i = 0; i < layer_.size(); ++i) {
+            const int idx = layer_[i];
+            if (repairs == max_repairs) {
+                next_layer_.insert(next_layer_.end(), layer_.begin() + i, layer_.end());
+                break;
+            }
+            vis_[std::size_t(idx)] = 0;
+            const FactorType current = toFactor(load_(idx));
+            const int count = conflictCount_(idx, current);
+            if (count == 0) continue;
+            ++repairs;
+            int best = std::numeric_limits<int>::max();
+            BitsetType candidates = 0u;
+            for (FactorType factor = 0; factor < getFactorCount(); ++factor) {
+                const int cnt = conflictCount_(idx, factor);
+                if (cnt < best) {
+                    best = cnt;
+                    candidates = 0u;
                 }
-                backup.swap(backup_);
-                backup_.clear();
-                create();
+                if (cnt == best) candidates |= 1u << factor;
             }
+            const FactorType factor = best < count ? Node(candidates).pick(*this) : current;
+            store_(idx, 1u << factor);
+            topology_.visit(idx, [&](const int target, const int label) {
+                if (!(allowed_(label, factor) >> toFactor(load_(target)) & 1u) && !vis_[std::size_t(target)]) {
+                    vis_[std::size_t(target)] = 1;
+                    next_layer_.push_back(target);
+                }
+                return true;
+            });
         }
+        std::swap(layer_, next_layer_);
+    }
+
+    // 剩余的冲突只可能出现在尚未处理的格子与其邻居之间
+    for (const int idx : layer_) {
+        vis_[std::size_t(idx)] = 0;
     }
-    return ret;
+    conflicts_.clear();
+    auto collect = [this](int idx) {
+        if (!vis_[std::size_t(idx)]) {
+            vis_[std::size_t(idx)] = 1;
+            conflicts_.push_back(idx);
+        }
+    };
+    for (const int idx : layer_) {
+        const FactorType factor = toFactor(load_(idx));
+        topology_.visit(idx, [&](const int target, const int label) {
+            if (!(allowed_(label, factor) >> toFactor(load_(target)) & 1u)) {
+                collect(idx);
+                collect(target);
+            }
+            return true;
+        });
+    }
+    for (const int idx : conflicts_) {
+        vis_[std::size_t(idx)] = 0;
+    }
+    layer_.clear();
+    status_ = Status::Done;
+    return conflicts_.size();
 }
 
 
 
-Generator<std::pair<Int2, WaveFunctionCollapse::FactorType>> WaveFunctionCollapse::generate_async()
+std::vector<Int3> WaveFunctionCollapse::getConflicts() const
 {
-    // BFS
-    struct State {
-        Int2 pos;
-        std::vector<FactorType> factors;
-        int idx;
-        decltype(backup_) backup;
-    };
-    std::vector<State> states(size_.y * size_.x);
-    int top = -1;
-
-    auto create = [this, &states, &top] {
-        const Int2 pos = find_();
-        todo_set_.erase(pos);
-        ++top;
-        states[top].pos = pos;
-        states[top].factors = mat_[pos].collapse(*this);
-        states[top].idx = 0;
-        states[top].backup.clear();
+    std::vector<Int3> res;
+    res.reserve(conflicts_.size());
+    for (const int idx : conflicts_) {
+        res.push_back(coord_(idx));
+    }
+    return res;
+}
+
+
+
+/*
+ * 格子 idx 放置图块 factor 时，不允许其出现在该方向上的邻居数量
+ */
+int WaveFunctionCollapse::conflictCount_(int idx, FactorType factor) const
+{
+    int res = 0;
+    topology_.visit(idx, [&](const int target, const int label) {
+        res += !(allowed_(label, factor) >> toFactor(load_(target)) & 1u);
+        return true;
+    });
+    return res;
+}
+
+
+
+/*
+ * 决定日志：每个决定为一个 LEB128 变长整数 (zigzag(下标之差) << 5) | 图块
+ * 决定时只有一种可能的格子同样记录：Queue 传播不会重新收缩同一次传播中已访问的格子，
+ * 一次施加全部决定后的传播不一定能推出这些格子
+ */
+std::vector<std::uint8_t> WaveFunctionCollapse::getDecisionLog() const
+{
+    std::vector<std::uint8_t> log;
+    int prev = 0;
+    for (const State& state : states_) {
+        const int pos = state.pos;
+        const FactorType factor = toFactor(load_(pos));
+        if (factor < 0) continue;
+        const long long delta = static_cast<long long>(pos) - prev;
+        const std::uint64_t zigzag = delta < 0 ? (std::uint64_t(-delta) << 1) - 1 : std::uint64_t(delta) << 1;
+        for (std::uint64_t value = zigzag << 5 | std::uint64_t(factor); ; value >>= 7) {
+            if (value < 0x80) {
+                log.push_back(static_cast<std::uint8_t>(value));
+                break;
+            }
+            log.push_back(static_cast<std::uint8_t>(value | 0x80));
+        }
+        prev = pos;
+    }
+    return log;
+}
+
+
+
+bool WaveFunctionCollapse::replay(std::span<const std::uint8_t> log)
+{
+    // 回放不选择格子，按最小熵的方式维护待决定集合即可，避免为其他策略建立数据结构
+    states_.clear();
+    backup_.clear();
+    backtracks_ = 0;
+    restarts_ = 0;
+    notified_ = 0;
+    find_mode_ = Heuristic::Entropy;
+    status_ = Status::Idle;
+
+    // 先施加全部决定，再从这些格子出发做一次传播，与 set(presets) 相同
+    const long long length = static_cast<long long>(vis_.length());
+    std::vector<int> seeds;
+    long long prev = 0;
+    for (std::size_t i = 0; i < log.size(); ) {
+        std::uint64_t value = 0;
+        for (int shift = 0; ; shift += 7) {
+            if (i == log.size() || shift > 63) {
+                restore_(0);
+                return false;
+            }
+            const std::uint8_t byte = log[i++];
+            value |= std::uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        const BitsetType bit = 1u << (value & 31);
+        const std::uint64_t zigzag = value >> 5;
+        const long long idx = prev + ((zigzag & 1) ? -static_cast<long long>(zigzag >> 1) - 1 : static_cast<long long>(zigzag >> 1));
+        if (idx < 0 || idx >= length) {
+            restore_(0);
+            return false;
+        }
+        prev = idx;
+        const BitsetType old = load_(idx);
+        if (old == bit) continue;
+        backup_.emplace_back(static_cast<int>(idx), Node(old));
+        if (!(old & bit)) {
+            contradiction_ = coord_(idx);
+            restore_(0);
+            return false;
+        }
+        store_(idx, bit);
+        seeds.push_back(static_cast<int>(idx));
+    }
+    if (!seeds.empty() && !spread_(seeds, 0)) {
+        return false;
+    }
+
+    // 决定过的格子与由传播确定的格子都不再待定
+    for (std::size_t i = todo_.size(); i-- > 0; ) {
+        if (std::has_single_bit(load_(todo_[i]))) {
+            todoErase_(todo_[i]);
+        }
+    }
+    if (!todo_.empty()) {
+        return false;
+    }
+    status_ = Status::Done;
+    return true;
+}
+
+
+
+/*
+ * 开始一次新的求解，当前的格子（包括 set() 的预设）成为撤销记录的起点
+ * 上一次求解没有完成时 states_ 中仍有它的决定，先撤销，否则这些决定会被当作预设，
+ * 栈中的格子也不在 todo_ 中而不再被选取；已完成的求解保留结果
+ */
+void WaveFunctionCollapse::start_()
+{
+    if (status_ != Status::Done) {
+        abandon_();
+    }
+    states_.clear();
+    backup_.clear();
+    backtracks_ = 0;
+    restarts_ = 0;
+    budget_restarts_ = 0;
+    restart_step_ = restart_interval_;
+    restart_after_ = restart_interval_;
+    notified_ = 0;
+    prepareFind_();
+    if (constraints_) {
+        constraints_->start_(*this);
+        for (int idx = 0; idx < static_cast<int>(vis_.length()); ++idx) {
+            constraints_->change_(idx, load_(idx));
+        }
+        if (!constraints_->commit_(0)) {
+            status_ = Status::Failed;
+            return;
+        }
+    }
+    if (todo_.empty()) {
+        status_ = Status::Done;
+        return;
+    }
+    status_ = Status::Running;
+    push_();
+}
+
+
+
+void WaveFunctionCollapse::push_()
+{
+    const int pos = find_();
+    todoErase_(pos);
+    const BitsetType options = load_(pos);
+    states_.push_back({pos, options, options, backup_.size()});
+}
+
+
+
+/*
+ * 推进一步：尝试栈顶格子剩余的图块直到有一个传播成功，全部失败时撤销该格子
+ */
+void WaveFunctionCollapse::advance_()
+{
+    while (true) {
+        auto& [pos, options, remaining, mark] = states_.back();
+
+        // 复位
+        restore_(mark);
+
+        if (!remaining) {
+            last_pos_ = pos;
+            last_factor_ = -1;
+            ++backtracks_;
+            todoInsert_(pos);
+            states_.pop_back();
+            if (states_.empty()) {
+                status_ = Status::Failed;
+            } else if (restart_interval_ && backtracks_ >= restart_after_) {
+                restart_step_ *= 2;
+                restart_after_ = backtracks_ + restart_step_;
+                restart_();
+            }
+            return;
+        }
+        const FactorType factor = Node(remaining).pick(*this);
+        remaining &= ~(1u << factor);
+        if (!diffuse_(pos, Node(1u << factor))) continue;
+        if (lookahead_ > 0 && !probe_cells_(mark)) continue;
+        if (constraints_ && !notify_()) continue;
+        last_pos_ = pos;
+        last_factor_ = factor;
+        if (todo_.empty()) [[unlikely]] {
+            status_ = Status::Done;
+            return;
+        }
+        push_();
+        if (memory_budget_ && getMemoryUsage().total() > memory_budget_) [[unlikely]] {
+            if (budget_action_ == BudgetAction::Restart && budget_restarts_ < max_restarts_) {
+                ++budget_restarts_;
+                restart_();
+            } else {
+                status_ = Status::OverBudget;
+            }
+        }
+        return;
+    }
+}
+
+
+
+/*
+ * 撤销所有决定并释放增长的撤销记录，从头重新搜索；随机数生成器接着使用，因此会走不同的路径
+ * 释放之后仍然超出预算时停止
+ */
+void WaveFunctionCollapse::restart_()
+{
+    abandon_();
+    std::vector<std::pair<int, Node>>().swap(backup_);
+    if (constraints_) {
+        constraints_->release_();
+    }
+    ++restarts_;
+    if (memory_budget_ && getMemoryUsage().total() > memory_budget_) {
+        status_ = Status::OverBudget;
+        return;
+    }
+    push_();
+}
+
+
+
+/*
+ * 撤销搜索栈中的全部决定，栈中的格子放回 todo_
+ */
+void WaveFunctionCollapse::abandon_()
+{
+    if (!states_.empty()) {
+        restore_(states_.front().mark);
+    }
+    while (!states_.empty()) {
+        todoInsert_(states_.back().pos);
+        states_.pop_back();
+    }
+}
+
+
+
+WaveFunctionCollapse::MemoryUsage WaveFunctionCollapse::getMemoryUsage() const
+{
+    auto bytes = []<typename T>(const std::vector<T>& v) {
+        return v.capacity() * sizeof(T);
     };
+    MemoryUsage res;
+    res.domains = std::visit([](const auto& cells) {
+        return cells.length() * sizeof(typename std::decay_t<decltype(cells)>::value_type);
+    }, mat_) + bytes(initial_);
+    res.undo = bytes(backup_);
+    res.stack = bytes(states_);
+    res.scratch = bytes(layer_) + bytes(next_layer_) + bytes(sweep_dirty_) + bytes(sweep_next_)
+        + bytes(sweep_changed_) + bytes(sweep_old_) + bytes(probe_) + vis_.length() * sizeof(std::uint8_t)
+        + bytes(par_mask_);
+    for (std::size_t c = 0; c < par_next_.size(); ++c) {
+        res.scratch += bytes(par_next_[c]) + bytes(par_backup_[c]);
+    }
+    res.select = bytes(todo_) + bytes(todo_pos_) + bytes(order_) + bytes(rank_)
+        + bytes(bucket_head_) + bytes(bucket_next_) + bytes(bucket_prev_) + bytes(bucket_of_);
+    res.rules = bytes(weights_) + bytes(label_funcs_) + bytes(rule_dirs_) + bytes(rule_support_) + bytes(rule_lut_) + bytes(rule_viable_)
+        + bytes(sweep_dirs_) + topology_.bytes();
+    if (constraints_) {
+        constraints_->memoryUsage_(res);
+    }
+    return res;
+}
 
-    bool ret = false;
-    create();
-    while (top >= 0) {
-        // fmt::print("stack size: {}\n", top + 1);
-        if (ret) --top;
-        else [[likely]] {
-            auto& [pos, factors, idx, backup] = states[top];
-            
-            // 复位
-            backup_.swap(backup);
-            backtrack();
-
-            if (idx == factors.size()) {
-                co_yield std::make_pair(pos, -1);
-                todo_set_.insert(pos);
-                --top;
-            } else [[likely]] {
-                const Node node(toBitset({factors[idx++]}));
-                if (!diffuse_(pos, node)) continue;
-                co_yield std::make_pair(pos, factors[idx - 1]);
-                if (top == states.size() - 1) [[unlikely]] {
-                    --top;
-                    ret = true;
-                    continue;
-                }
-                backup.swap(backup_);
-                backup_.clear();
-                create();
+
+
+/*
+ * 把上次报告之后改动过的格子报告给全局约束并检查
+ * 失败时由调用者撤销，restore_() 会同时撤销约束的状态
+ */
+bool WaveFunctionCollapse::notify_()
+{
+    for (std::size_t i = notified_; i < backup_.size(); ++i) {
+        const int idx = backup_[i].first;
+        constraints_->change_(idx, load_(idx));
+    }
+    notified_ = backup_.size();
+    return constraints_->commit_(notified_);
+}
+
+
+
+/*
+ * 前瞻：对 mark 之后被改动过、可能性不多的格子逐一试探每个图块，删去立即矛盾的图块
+ * 删去图块后的传播与试探一样记入 backup_，由调用者按 mark 撤销
+ * 某个格子的所有图块都矛盾时返回 false
+ */
+bool WaveFunctionCollapse::probe_cells_(std::size_t mark)
+{
+    probe_.clear();
+    for (std::size_t i = mark; i < backup_.size(); ++i) {
+        probe_.push_back(backup_[i].first);
+    }
+    std::sort(probe_.begin(), probe_.end());
+    probe_.erase(std::unique(probe_.begin(), probe_.end()), probe_.end());
+
+    for (const int idx : probe_) {
+        const BitsetType bitset = load_(idx);
+        const int count = std::popcount(bitset);
+        if (count < 2 || count > lookahead_) continue;
+        BitsetType keep = 0;
+        for (BitsetType rest = bitset; rest; rest &= rest - 1) {
+            const BitsetType bit = rest & (~rest + 1);
+            const std::size_t probe_mark = backup_.size();
+            if (diffuse_(idx, Node(bit))) {
+                keep |= bit;
+                restore_(probe_mark);
             }
         }
+        if (keep == bitset) continue;
+        if (!keep || !diffuse_(idx, Node(keep))) {
+            return false;
+        }
     }
-    co_return;
+    return true;
 }
 
 
@@ -234,23 +871,281 @@ void WaveFunctionCollapse::print() const
 {
     static const char* symbols = &"? .:+*%#@/"[1];
 
-    for (int i = 0; i < size_.y; ++i) {
-        for (int j = 0; j < size_.x; ++j) {
-            fmt::print("{}", symbols[std::min(toFactor(get({i, j})), 8)]);
+    for (int k = 0; k < size_.z; ++k) {
+        if (k) fmt::print("\n");
+        for (int i = 0; i < size_.y; ++i) {
+            for (int j = 0; j < size_.x; ++j) {
+                fmt::print("{}", symbols[std::min(toFactor(get(Int3{k, i, j})), 8)]);
+            }
+            fmt::print("\n");
+        }
+    }
+}
+
+
+
+void WaveFunctionCollapse::todoInsert_(int idx)
+{
+    todo_pos_[idx] = static_cast<int>(todo_.size());
+    todo_.push_back(idx);
+    switch (find_mode_) {
+    case Heuristic::Entropy:
+        break;
+    case Heuristic::MRV:
+        bucketInsert_(idx, load_(idx));
+        break;
+    default:
+        cursor_ = std::min(cursor_, rank_.empty() ? idx : rank_[idx]);
+        break;
+    }
+}
+
+
+
+void WaveFunctionCollapse::todoErase_(int idx)
+{
+    const int i = todo_pos_[idx];
+    todo_pos_[todo_.back()] = i;
+    todo_[i] = todo_.back();
+    todo_.pop_back();
+    todo_pos_[idx] = -1;
+    if (find_mode_ == Heuristic::MRV) {
+        bucketErase_(idx);
+    }
+}
+
+
+
+void WaveFunctionCollapse::bucketInsert_(int idx, BitsetType bitset)
+{
+    const int key = std::popcount(bitset);
+    bucket_of_[idx] = static_cast<std::int8_t>(key);
+    const int head = bucket_head_[key];
+    if (head < 0) {
+        bucket_head_[key] = idx;
+        bucket_prev_[idx] = bucket_next_[idx] = idx;
+        return;
+    }
+    const int tail = bucket_prev_[head];
+    bucket_prev_[idx] = tail;
+    bucket_next_[idx] = head;
+    bucket_next_[tail] = idx;
+    bucket_prev_[head] = idx;
+}
+
+
+
+void WaveFunctionCollapse::bucketErase_(int idx)
+{
+    const int key = bucket_of_[idx];
+    const int prev = bucket_prev_[idx];
+    const int next = bucket_next_[idx];
+    bucket_of_[idx] = -1;
+    if (next == idx) {
+        bucket_head_[key] = -1;
+        return;
+    }
+    bucket_next_[prev] = next;
+    bucket_prev_[next] = prev;
+    if (bucket_head_[key] == idx) bucket_head_[key] = next;
+}
+
+
+
+/*
+ * MRV 时 backup_ 中 mark 之后记录的格子发生了变化，按新的可能性数量重新分桶
+ */
+void WaveFunctionCollapse::touch_(std::size_t mark)
+{
+    for (std::size_t i = mark; i < backup_.size(); ++i) {
+        const int idx = backup_[i].first;
+        if (bucket_of_[idx] >= 0) {
+            bucketErase_(idx);
+            bucketInsert_(idx, load_(idx));
+        }
+    }
+}
+
+
+
+/*
+ * 逆序撤销 backup_ 中 mark 之后的修改
+ */
+void WaveFunctionCollapse::restore_(std::size_t mark)
+{
+    if (mark < notified_) {
+        if (constraints_) constraints_->rollback_(mark);
+        notified_ = mark;
+    }
+    const bool mrv = find_mode_ == Heuristic::MRV;
+    std::visit([this, mark, mrv](auto& cells) {
+        using T = typename std::decay_t<decltype(cells)>::value_type;
+        while (backup_.size() > mark) {
+            const auto [idx, node] = backup_.back();
+            cells[std::size_t(idx)] = static_cast<T>(node.bitset);
+            backup_.pop_back();
+            if (mrv && bucket_of_[idx] >= 0) {
+                bucketErase_(idx);
+                bucketInsert_(idx, node.bitset);
+            }
+        }
+    }, mat_);
+}
+
+
+
+/*
+ * 按希尔伯特曲线的第 d 个点，n 为 2 的幂
+ */
+static Int2 hilbert_point(int n, long long d)
+{
+    int x = 0, y = 0;
+    for (int k = 1; k < n; k *= 2, d /= 4) {
+        const int rx = static_cast<int>(1 & (d / 2));
+        const int ry = static_cast<int>(1 & (d ^ rx));
+        if (ry == 0) {
+            if (rx == 1) {
+                x = k - 1 - x;
+                y = k - 1 - y;
+            }
+            std::swap(x, y);
+        }
+        x += k * rx;
+        y += k * ry;
+    }
+    return {y, x};
+}
+
+
+
+/*
+ * 在一次求解开始时为选择策略建立数据结构
+ */
+void WaveFunctionCollapse::prepareFind_()
+{
+    find_mode_ = heuristic_;
+    order_.clear();
+    rank_.clear();
+    cursor_ = 0;
+    bucket_head_.clear();
+    bucket_next_.clear();
+    bucket_prev_.clear();
+    bucket_of_.clear();
+
+    const int length = static_cast<int>(vis_.length());
+    switch (find_mode_) {
+    case Heuristic::Entropy:
+    case Heuristic::Scanline:
+        break;
+
+    case Heuristic::MRV:
+        bucket_head_.assign(33, -1);
+        bucket_next_.resize(length);
+        bucket_prev_.resize(length);
+        bucket_of_.assign(length, -1);
+        for (const int idx : todo_) {
+            bucketInsert_(idx, load_(idx));
+        }
+        break;
+
+    case Heuristic::Hilbert:
+        // 只有一行时（例如任意图）即为存储顺序
+        if (size_.y > 1) {
+            int n = 1;
+            while (n < size_.y || n < size_.x) n *= 2;
+            order_.reserve(length);
+            for (int z = 0; z < size_.z; ++z) {
+                for (long long d = 0; d < 1LL * n * n; ++d) {
+                    const Int2 p = hilbert_point(n, d);
+                    if (p.y < size_.y && p.x < size_.x) {
+                        order_.push_back(static_cast<int>(index_(Int3(z, p.y, p.x))));
+                    }
+                }
+            }
+        }
+        break;
+
+    case Heuristic::Spiral: {
+        // 从与 init() 之后的初始状态不同的格子（即预设）出发做多源广度优先搜索，没有预设时从中心出发
+        // 初始状态中规则分析删去图块的格子不算，否则边界附近的格子都会成为起点
+        // 借用 vis_ 标记已加入的格子，2 暂时标记与初始状态相同的格子，结束后清零
+        order_.reserve(length);
+        for (const auto& [idx, bitset] : initial_) {
+            vis_[std::size_t(idx)] = load_(idx) == bitset ? 2 : 1;
+        }
+        for (int idx = 0; idx < length; ++idx) {
+            auto& mark = vis_[std::size_t(idx)];
+            if (mark == 2) {
+                mark = 0;
+            } else if (mark == 1 || load_(idx) != getFactorMask()) {
+                mark = 1;
+                order_.push_back(idx);
+            }
+        }
+        if (order_.empty() && length > 0) {
+            const int center = static_cast<int>(index_(Int3(size_.z / 2, size_.y / 2, size_.x / 2)));
+            vis_[std::size_t(center)] = 1;
+            order_.push_back(center);
+        }
+        for (std::size_t head = 0; head < order_.size(); ++head) {
+            topology_.visit(order_[head], [&](const int idx, int) {
+                if (!vis_[std::size_t(idx)]) {
+                    vis_[std::size_t(idx)] = 1;
+                    order_.push_back(idx);
+                }
+                return true;
+            });
+        }
+        // 不连通的部分按存储顺序补在最后
+        for (int idx = 0; idx < length; ++idx) {
+            if (!vis_[std::size_t(idx)]) order_.push_back(idx);
+        }
+        vis_.fill(0);
+        break;
+    }
+    }
+
+    if (!order_.empty()) {
+        rank_.resize(length);
+        for (int r = 0; r < length; ++r) {
+            rank_[order_[r]] = r;
         }
-        fmt::print("\n");
     }
 }
 
 
 
-Int2 WaveFunctionCollapse::find_() const
+int WaveFunctionCollapse::find_()
 {
-    Int2 res;
+    switch (find_mode_) {
+    case Heuristic::Entropy:
+        return findEntropy_();
+
+    case Heuristic::MRV:
+        for (const int head : bucket_head_) {
+            if (head >= 0) return head;
+        }
+        return -1;
+
+    default:
+        // cursor_ 之前的格子都已决定，回溯时由 todoInsert_ 前移
+        while (true) {
+            const int idx = order_.empty() ? cursor_ : order_[cursor_];
+            if (todo_pos_[idx] >= 0) return idx;
+            ++cursor_;
+        }
+    }
+}
+
+
+
+int WaveFunctionCollapse::findEntropy_() const
+{
+    int res = -1;
     int cnt = 0;
     double entropy = std::numeric_limits<double>::max();
-    for (Int2 pos : todo_set_) {
-        const double ep = mat_[pos].getEntropy(*this);
+    for (const int pos : todo_) {
+        const double ep = Node(load_(pos)).getEntropy(*this);
         if (ep < entropy) {
             res = pos;
             entropy = ep;
@@ -269,73 +1164,522 @@ Int2 WaveFunctionCollapse::find_() const
 
 
 
-bool WaveFunctionCollapse::diffuse_(Int2 ppos, Node node)
+void WaveFunctionCollapse::setRule(std::vector<Int3> dirs, const std::vector<BitsetType>& support)
+{
+    const int count = getFactorCount();
+    rule_dirs_ = std::move(dirs);
+    rule_support_ = support;
+    rule_lut_.assign(rule_dirs_.size() * 4 * 256, 0u);
+    for (int d = 0; d < static_cast<int>(rule_dirs_.size()); ++d) {
+        for (int chunk = 0; chunk * 8 < count; ++chunk) {
+            BitsetType* lut = &rule_lut_[(d * 4 + chunk) * 256];
+            for (int byte = 1; byte < 256; ++byte) {
+                // 由去掉最低位的结果递推
+                const int low = std::countr_zero(unsigned(byte));
+                const int id = chunk * 8 + low;
+                lut[byte] = lut[byte & (byte - 1)] | (id < count ? support[d * count + id] : 0u);
+            }
+        }
+    }
+
+    // 规则分析：某个方向上没有可以相邻的图块的图块，不可能出现在该方向上有邻居的格子中；
+    // 在所有方向上都有邻居的格子中，反复删去这样的图块直到不动点
+    const BitsetType full = getFactorMask();
+    rule_viable_.assign(rule_dirs_.size(), 0u);
+    for (int d = 0; d < static_cast<int>(rule_dirs_.size()); ++d) {
+        for (int t = 0; t < count; ++t) {
+            if (support[d * count + t] & full) rule_viable_[d] |= 1u << t;
+        }
+    }
+    BitsetType alive = full;
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (int t = 0; t < count; ++t) {
+            if (!(alive >> t & 1u)) continue;
+            for (int d = 0; d < static_cast<int>(rule_dirs_.size()); ++d) {
+                if (!(support[d * count + t] & alive)) {
+                    alive &= ~(1u << t);
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+    dead_factors_ = full & ~alive;
+}
+
+
+
+std::uint64_t WaveFunctionCollapse::getRuleHash() const
+{
+    if (rule_dirs_.empty() || custom_topology_) {
+        return 0;
+    }
+    FnvHash hash;
+    hash.add(std::span(weights_));
+    hash.add(std::span(rule_dirs_));
+    hash.add(std::span(rule_support_));
+    hash.add(size_);
+    hash.add(heuristic_);
+    hash.add(propagation_);
+    hash.add(lookahead_);
+    hash.add(restart_interval_);
+    hash.add(memory_budget_);
+    hash.add(budget_action_);
+    hash.add(max_restarts_);
+    hash.add(constraints_ ? constraints_->hash_() : std::uint64_t(0));
+    const std::uint64_t res = hash.value();
+    return res ? res : 1;
+}
+
+
+
+/*
+ * 影响算法的两种实现，diffuse_impl_ 针对它们分别实例化
+ * support(label, bitset) 计算标签为 label 的方向上允许的邻居集合
+ */
+class WaveFunctionCollapse::FuncSupport
+{
+public:
+    const WaveFunctionCollapse& wfc;
+
+    BitsetType operator()(int label, BitsetType bitset) const {
+        const int group = wfc.label_funcs_[label];
+        if (group < 0) return ~0u;
+        return wfc.diffuse_funcs_[group].second(bitset, wfc.topology_.dir(label));
+    }
+};
+
+
+
+template <int Chunks>
+class WaveFunctionCollapse::TableSupport
+{
+public:
+    const WaveFunctionCollapse& wfc;
+
+    BitsetType operator()(int label, BitsetType bitset) const {
+        const BitsetType* lut = &wfc.rule_lut_[label * 4 * 256];
+        BitsetType res = lut[bitset & 0xffu];
+        if constexpr (Chunks > 1) res |= lut[1 * 256 + (bitset >>  8 & 0xffu)];
+        if constexpr (Chunks > 2) res |= lut[2 * 256 + (bitset >> 16 & 0xffu)];
+        if constexpr (Chunks > 3) res |= lut[3 * 256 + (bitset >> 24 & 0xffu)];
+        return res;
+    }
+};
+
+
+
+WaveFunctionCollapse::BitsetType WaveFunctionCollapse::allowed_(int label, FactorType factor) const
+{
+    if (!rule_dirs_.empty()) {
+        return rule_support_[label * getFactorCount() + factor];
+    }
+    return FuncSupport{*this}(label, 1u << factor);
+}
+
+
+
+/*
+ * 未指定拓扑时按规则的方向生成有界网格，方向不变时沿用已有的结果
+ * 同时建立标签到规则的对应关系，标签超出规则的方向数量时返回 false
+ */
+bool WaveFunctionCollapse::buildTopology_()
 {
-    static std::queue<Int2> queue;
-    static std::unordered_set<Int2> in_queue;
-    while (!queue.empty()) {
-        queue.pop();
+    std::vector<Int3> dirs = rule_dirs_;
+    if (dirs.empty()) {
+        for (const auto& [group, func] : diffuse_funcs_) {
+            dirs.insert(dirs.end(), group.begin(), group.end());
+        }
+    }
+    if (!custom_topology_ && (topology_.size() != size_ || topology_.dirs() != dirs)) {
+        topology_ = Topology::grid(size_, dirs);
+    }
+
+    if (!rule_dirs_.empty()) {
+        label_funcs_.clear();
+        return std::size_t(topology_.labelCount()) <= rule_dirs_.size();
+    }
+    label_funcs_.assign(topology_.labelCount(), -1);
+    if (!custom_topology_) {
+        // 自动生成的网格按拼接顺序编号，位移相同的两个方向也属于各自的组
+        int label = 0;
+        for (int g = 0; g < static_cast<int>(diffuse_funcs_.size()); ++g) {
+            for (std::size_t i = 0; i < diffuse_funcs_[g].first.size(); ++i) {
+                label_funcs_[label++] = g;
+            }
+        }
+        return true;
+    }
+    for (int label = 0; label < topology_.labelCount(); ++label) {
+        for (int g = 0; g < static_cast<int>(diffuse_funcs_.size()) && label_funcs_[label] < 0; ++g) {
+            const auto& group = diffuse_funcs_[g].first;
+            if (std::find(group.begin(), group.end(), topology_.dir(label)) != group.end()) {
+                label_funcs_[label] = g;
+            }
+        }
+    }
+    return true;
+}
+
+
+
+/*
+ * 按规则分析的结果，删去每个格子在其存在的邻居方向上没有可以相邻的图块的图块，再从这些格子出发传播到不动点
+ * 结果作为求解的初始状态，不记入撤销记录，并记入 initial_；有格子变空时规则在此尺寸下无解
+ */
+bool WaveFunctionCollapse::analyze_()
+{
+    initial_.clear();
+    const BitsetType full = getFactorMask();
+    if (std::all_of(rule_viable_.begin(), rule_viable_.end(), [full](BitsetType mask) { return mask == full; })) {
+        return true;
     }
-    in_queue.clear();
-    
+    std::vector<int> seeds;
+    for (int idx = 0; idx < static_cast<int>(vis_.length()); ++idx) {
+        BitsetType mask = full;
+        topology_.visit(idx, [&](int, int label) {
+            mask &= rule_viable_[label];
+            return true;
+        });
+        if (mask == full) continue;
+        const BitsetType old = load_(idx);
+        backup_.emplace_back(idx, Node(old));
+        store_(idx, old & mask);
+        if (!(old & mask)) {
+            contradiction_ = coord_(idx);
+            backup_.clear();
+            return false;
+        }
+        seeds.push_back(idx);
+    }
+    const bool ok = seeds.empty() || spread_(seeds, 0);
+    if (ok) {
+        for (const auto& [idx, old] : backup_) {
+            if (old.bitset == full) initial_.emplace_back(idx, load_(idx));
+        }
+    }
+    backup_.clear();
+    return ok;
+}
+
+
+
+bool WaveFunctionCollapse::diffuse_(int idx, Node node)
+{
+    const std::size_t mark = backup_.size();
+    backup_.emplace_back(idx, Node(load_(idx)));
+    store_(idx, node.bitset);
+    return spread_(std::span(&idx, 1), mark);
+}
+
+
+
+/*
+ * 从 seeds 出发做一次约束传播
+ * mark 为调用者修改 seeds 之前 backup_ 的长度，失败时撤销到 mark 并记录矛盾的位置
+ */
+bool WaveFunctionCollapse::spread_(std::span<const int> seeds, std::size_t mark)
+{
+    bool ok;
+    if (propagation_ == Propagation::Sweep && topology_.isGrid()) {
+        for (const int idx : seeds) {
+            const Int3 pos = coord_(idx);
+            sweep_dirty_[pos.z * size_.y + pos.y] = 1;
+        }
+        ok = sweep_(mark);
+    } else {
+        ok = spreadQueue_(seeds, mark);
+    }
+    if (ok && find_mode_ == Heuristic::MRV) {
+        touch_(mark);
+    }
+    return ok;
+}
+
+
+
+bool WaveFunctionCollapse::spreadQueue_(std::span<const int> seeds, std::size_t mark)
+{
+    return std::visit([&](auto& cells) {
+        if (rule_dirs_.empty()) {
+            return diffuse_impl_(cells, seeds, mark, FuncSupport{*this});
+        }
+        switch ((getFactorCount() + 7) / 8) {
+        case 1: return diffuse_impl_(cells, seeds, mark, TableSupport<1>{*this});
+        case 2: return diffuse_impl_(cells, seeds, mark, TableSupport<2>{*this});
+        case 3: return diffuse_impl_(cells, seeds, mark, TableSupport<3>{*this});
+        default: return diffuse_impl_(cells, seeds, mark, TableSupport<4>{*this});
+        }
+    }, mat_);
+}
+
+
+
+template <typename T, typename Support>
+bool WaveFunctionCollapse::diffuse_impl_(Matrix3<T>& cells, std::span<const int> seeds, std::size_t mark, Support support)
+{
+    layer_.clear();
+    next_layer_.clear();
+
     /*
-     * 对 mat_[pos] 施加约束
-     * 取 mar_[pos].factors 与 valid 的交集
-     * 如果 mat_[pos].factors 变空，返回 false
+     * 对 cells[idx] 施加约束
+     * 取 cells[idx] 与 valid 的交集
+     * 如果 cells[idx] 变空，返回 false
      */
-    auto update_node = [this](const Int2 pos, const BitsetType valid) {
-        Node& node = mat_[pos];
-        const Node tmp = node;
-        node.bitset &= valid & getFactorMask();
-        if (tmp != node) {
-            backup_.emplace(pos, tmp);
-            if (mat_[pos].isEmpty()) [[unlikely]] {
+    auto update_node = [this, &cells](const int idx, const BitsetType valid) {
+        T& cell = cells[std::size_t(idx)];
+        const T tmp = cell;
+        cell &= static_cast<T>(valid);
+        if (tmp != cell) {
+            if (!cell) [[unlikely]] {
+                if (approx_) {
+                    cell = tmp;
+                    conflicts_.push_back(idx);
+                    return true;
+                }
+                backup_.emplace_back(idx, Node(tmp));
+                contradiction_ = coord_(idx);
                 return false;
             }
-            if (!in_queue.contains(pos)) [[likely]] {
-                in_queue.insert(pos);
+            backup_.emplace_back(idx, Node(tmp));
+            if (vis_[std::size_t(idx)] == 0) [[likely]] {
+                vis_[std::size_t(idx)] = 1;
+                next_layer_.push_back(idx);
             }
         }
         return true;
     };
 
-    backup_.emplace(ppos, mat_[ppos]);
-    mat_[ppos] = node;
-    vis_[ppos] = true;
-    queue.push(ppos);
-    while (!queue.empty()) {
-        for (int t = queue.size(); t--;) {
-            const Int2 pp = queue.front();
-            queue.pop();
-            for (const auto& [dirs, func] : diffuse_funcs_) {
-                for (const Int2 dp : dirs) {
-                    if (const Int2 pos = pp + dp; Int2::Range(size_).contains(pos) && !vis_[pos]) [[likely]] {
-                        const BitsetType valid = func(mat_[pp].bitset, dp);
-                        if (!update_node(pos, valid)) [[unlikely]] {
-                            for (const auto [pos, node] : backup_) {
-                                mat_[pos] = node;
-                                vis_[pos] = false;
-                            }
-                            backup_.clear();
-                            return false;
-                        }
-                    }
+    /*
+     * 第一层中的源点之间可以互相约束，之后才标记为已访问
+     * 只有一个源点时与先标记再扩散等价
+     */
+    /*
+     * 并行时第一层有多个源点的情况仍然顺序处理，因为源点之间互相约束的结果与处理顺序有关
+     * 之后每一层的源点都已标记为已访问，只约束下一层，结果与顺序无关
+     */
+    const bool parallel = propagation_ == Propagation::Parallel && pool_ && !approx_ && !std::is_same_v<Support, FuncSupport>;
+    layer_.assign(seeds.begin(), seeds.end());
+    for (bool first = true; !layer_.empty(); first = false) {
+        bool ok = true;
+        if (parallel && layer_.size() >= PARALLEL_LAYER && !(first && seeds.size() > 1)) {
+            ok = parallel_layer_(cells, support);
+        } else {
+            for (const int pp : layer_) {
+                const BitsetType bitset = cells[std::size_t(pp)];
+                ok = topology_.visit(pp, [&](const int idx, const int label) {
+                    return vis_[std::size_t(idx)] == 2 || update_node(idx, support(label, bitset));
+                });
+                if (!ok) break;
+            }
+        }
+        if (!ok) [[unlikely]] {
+            for (std::size_t i = mark; i < backup_.size(); ++i) {
+                vis_[std::size_t(backup_[i].first)] = 0;
+            }
+            restore_(mark);
+            return false;
+        }
+        if (first) {
+            for (const int idx : seeds) {
+                vis_[std::size_t(idx)] = 2;
+            }
+        }
+        for (const int idx : next_layer_) {
+            vis_[std::size_t(idx)] = 2;
+        }
+        layer_.swap(next_layer_);
+        next_layer_.clear();
+    }
+
+    for (std::size_t i = mark; i < backup_.size(); ++i) {
+        vis_[std::size_t(backup_[i].first)] = 0;
+    }
+    return true;
+}
+
+
+
+/*
+ * 并行处理一层：按 layer_ 的顺序切成连续的分块，逐层扩散得到的一层沿波前排列，每个分块即波前上相邻的一段
+ * 第一阶段只读格子，把约束按位与进 par_mask_，第一个使格子变化的分块把它加入自己的下一层；
+ * 第二阶段每个格子只属于一个分块，各自写回并记录旧值，最后按分块的顺序合并
+ * 有格子变空时以其中位置最小的一个作为矛盾，由调用者撤销
+ */
+template <typename T, typename Support>
+bool WaveFunctionCollapse::parallel_layer_(Matrix3<T>& cells, Support support)
+{
+    const std::size_t chunks = std::min(layer_.size(), pool_->size() * 4);
+    const std::size_t per = (layer_.size() + chunks - 1) / chunks;
+    if (par_next_.size() < chunks) {
+        par_next_.resize(chunks);
+        par_backup_.resize(chunks);
+    }
+    if (par_mask_.size() != vis_.length()) {
+        par_mask_.assign(vis_.length(), ~0u);
+    }
+
+    pool_->parallelFor(chunks, [&](std::size_t c) {
+        std::vector<int>& next = par_next_[c];
+        next.clear();
+        const std::size_t end = std::min(layer_.size(), (c + 1) * per);
+        for (std::size_t i = c * per; i < end; ++i) {
+            const int pp = layer_[i];
+            const BitsetType bitset = cells[std::size_t(pp)];
+            topology_.visit(pp, [&](const int idx, const int label) {
+                std::atomic_ref<std::uint8_t> vis(vis_[std::size_t(idx)]);
+                if (vis.load(std::memory_order_relaxed) == 2) return true;
+                const BitsetType cell = cells[std::size_t(idx)];
+                const BitsetType valid = support(label, bitset);
+                if ((cell & valid) == cell) return true;
+                std::atomic_ref<BitsetType>(par_mask_[std::size_t(idx)]).fetch_and(valid, std::memory_order_relaxed);
+                std::uint8_t expected = 0;
+                if (vis.compare_exchange_strong(expected, 1, std::memory_order_relaxed)) {
+                    next.push_back(idx);
                 }
+                return true;
+            });
+        }
+    });
+
+    pool_->parallelFor(chunks, [&](std::size_t c) {
+        auto& backup = par_backup_[c];
+        backup.clear();
+        for (const int idx : par_next_[c]) {
+            const T old = cells[std::size_t(idx)];
+            cells[std::size_t(idx)] = old & static_cast<T>(par_mask_[std::size_t(idx)]);
+            par_mask_[std::size_t(idx)] = ~0u;
+            backup.emplace_back(idx, Node(old));
+        }
+    });
+
+    int empty = -1;
+    for (std::size_t c = 0; c < chunks; ++c) {
+        for (const auto& entry : par_backup_[c]) {
+            backup_.push_back(entry);
+            if (!cells[std::size_t(entry.first)] && (empty < 0 || entry.first < empty)) {
+                empty = entry.first;
             }
         }
-        for (const Int2 pos : in_queue) {
-            vis_[pos] = true;
-            queue.push(pos);
+        next_layer_.insert(next_layer_.end(), par_next_[c].begin(), par_next_[c].end());
+    }
+    if (empty >= 0) [[unlikely]] {
+        contradiction_ = coord_(empty);
+        return false;
+    }
+    return true;
+}
+
+
+
+/*
+ * 对一整行施加同一方向的约束，dst[i] &= valid(src[i])
+ * 记录发生变化的下标与旧值，返回发生变化的数量
+ */
+template <typename T, typename Valid>
+static std::size_t narrow_row(T* dst, const T* src, int n, Valid&& valid, int* changed, std::uint32_t* old)
+{
+    std::size_t m = 0;
+    for (int i = 0; i < n; ++i) {
+        const T tmp = dst[i];
+        const T res = tmp & static_cast<T>(valid(src[i]));
+        if (res != tmp) {
+            dst[i] = res;
+            changed[m] = i;
+            old[m++] = tmp;
         }
-        in_queue.clear();
     }
+    return m;
+}
+
+
+
+bool WaveFunctionCollapse::sweep_(std::size_t mark)
+{
+    return std::visit([&](auto& cells) { return sweep_impl_(cells, mark); }, mat_);
+}
 
-    for (const auto [pos, _] : backup_) {
-        vis_[pos] = false;
+
+
+/*
+ * 以行为单位的约束传播
+ * sweep_dirty_[z * rows + y] 表示第 (z, y) 行在上一轮中发生了变化，需要作为约束来源重新扫描
+ * 同一轮中的修改立即可见，直到没有任何行发生变化
+ * 失败时撤销到 mark，返回时 sweep_dirty_ 全为 0
+ * 32 位存储的邻接兼容表规则使用 simd::narrow，其余情况逐个格子计算
+ */
+template <typename T>
+bool WaveFunctionCollapse::sweep_impl_(Matrix3<T>& cells, std::size_t mark)
+{
+    const auto& dirs = sweep_dirs_;
+    auto& dirty = sweep_dirty_;
+    auto& next = sweep_next_;
+    const int count = getFactorCount();
+
+    auto narrow = [&](int k, T* dst, const T* src, int n) -> std::size_t {
+        if (dirs[k].second == nullptr) {
+            if constexpr (std::is_same_v<T, BitsetType>) {
+                return simd::narrow(dst, src, n, &rule_support_[k * count], count,
+                                    sweep_changed_.data(), sweep_old_.data());
+            } else {
+                const TableSupport<sizeof(T)> support{*this};
+                return narrow_row(dst, src, n, [&](T bitset) { return support(k, bitset); },
+                                  sweep_changed_.data(), sweep_old_.data());
+            }
+        }
+        const auto& func = *dirs[k].second;
+        const Int3 dp = dirs[k].first;
+        return narrow_row(dst, src, n, [&](T bitset) { return func(bitset, dp); },
+                          sweep_changed_.data(), sweep_old_.data());
+    };
+
+    for (bool any = true; any;) {
+        any = false;
+        for (int z = 0; z < size_.z; ++z) {
+            for (int y = 0; y < size_.y; ++y) {
+                if (!dirty[z * size_.y + y]) continue;
+                for (int k = 0; k < static_cast<int>(dirs.size()); ++k) {
+                    const Int3 dp = dirs[k].first;
+                    const int tz = z + dp.z;
+                    const int ty = y + dp.y;
+                    const int x0 = std::max(0, -dp.x);
+                    const int x1 = std::min(size_.x, size_.x - dp.x);
+                    if (tz < 0 || tz >= size_.z || ty < 0 || ty >= size_.y || x0 >= x1) continue;
+                    T* dst = cells.row(tz, ty) + x0 + dp.x;
+                    const T* src = cells.row(z, y) + x0;
+                    const std::size_t m = narrow(k, dst, src, x1 - x0);
+                    // narrow 已经写回整行，矛盾之后的格子也已修改：先记录整行的修改再检查矛盾，
+                    // 否则 restore_ 只撤销到矛盾为止，这一行后面的格子会保留收缩后的值
+                    int empty = -1;
+                    for (std::size_t j = 0; j < m; ++j) {
+                        const Int3 pos(tz, ty, x0 + dp.x + sweep_changed_[j]);
+                        const std::size_t idx = cells.index(pos);
+                        backup_.emplace_back(static_cast<int>(idx), Node(sweep_old_[j]));
+                        if (empty < 0 && !cells[idx]) [[unlikely]] {
+                            empty = pos.x;
+                        }
+                    }
+                    if (empty >= 0) [[unlikely]] {
+                        contradiction_ = Int3(tz, ty, empty);
+                        restore_(mark);
+                        std::fill(dirty.begin(), dirty.end(), 0);
+                        std::fill(next.begin(), next.end(), 0);
+                        return false;
+                    }
+                    if (m) {
+                        next[tz * size_.y + ty] = 1;
+                        any = true;
+                    }
+                }
+            }
+        }
+        dirty.swap(next);
+        std::fill(next.begin(), next.end(), 0);
     }
     return true;
 }
 
 
 
-} // namespace cha
\ No newline at end of file
+} // namespace cha
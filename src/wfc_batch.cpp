@@ -0,0 +1,418 @@
+#include "wfc_batch.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#define CHA_SIMD_X86 1
+#endif
+namespace cha
+{
+
+
+
+using BitsetType = WaveFunctionCollapse::BitsetType;
+using WeightType = WaveFunctionCollapse::WeightType;
+
+
+
+// 每张地图换种子重试的次数
+static constexpr int RETRIES = 4;
+
+
+
+BatchCollapse::BatchCollapse(Int2 size, std::vector<BitsetType> support, std::vector<WeightType> weights)
+    : size_(size), support_(std::move(support)), weights_(std::move(weights)), fallback_(size.y, size.x, &gen_)
+{
+    fallback_.getWeights() = weights_;
+    fallback_.setRule(std::vector<Int3>(std::begin(DIR4), std::end(DIR4)), support_);
+    fallback_.setHeuristic(WaveFunctionCollapse::Heuristic::MRV);
+    // 通道内以 16 位随机数与权重之和相乘来选取，权重之和超过 0xff00 时按比例缩小，保证乘积不溢出
+    long long sum = 0;
+    for (const WeightType weight : weights_) sum += std::max<WeightType>(weight, 0);
+    for (const WeightType weight : weights_) {
+        long long scaled = std::max<WeightType>(weight, 0);
+        if (sum > 0xff00) scaled = std::max(scaled * 0xff00 / sum, scaled > 0 ? 1LL : 0LL);
+        lane_weights_.push_back(static_cast<BitsetType>(scaled));
+    }
+    // 规则在此尺寸下无解时 initial_ 为空
+    if (fallback_.init()) {
+        initial_.resize(std::size_t(size_.y) * size_.x);
+        for (const Int2 pos : Int2::Range(size_)) {
+            initial_[std::size_t(pos.y) * size_.x + pos.x] = fallback_.get(pos);
+        }
+    }
+}
+
+
+
+namespace
+{
+
+template <int L>
+struct LaneVector;
+
+template <>
+struct LaneVector<8>
+{
+    typedef std::uint32_t type __attribute__((vector_size(32)));
+};
+
+template <>
+struct LaneVector<16>
+{
+    typedef std::uint32_t type __attribute__((vector_size(64)));
+};
+
+
+
+/*
+ * 一组通道的同步求解，由按指令集编译的内核执行
+ * active 输入为参与求解的通道，输出为同步求解成功的通道；
+ * 中途离开的通道的可能性写入 retired + 通道 * 格子数量，其中决定失败的图块已经去掉
+ */
+struct LaneGroup
+{
+    int height;
+    int width;
+    int count;
+    const BitsetType* support;
+    const BitsetType* weights;
+    BitsetType* cells;
+    BitsetType* retired;
+    std::uint32_t* states;
+    int* queue;
+    char* queued;
+    std::vector<int>* trail_pos;
+    std::vector<BitsetType>* trail_old;
+    unsigned active;
+};
+
+
+
+// 以下函数总是内联到按指令集编译的内核中，向量运算按内核的指令集生成
+
+// 向量以引用传递，避免不同指令集下按值传递的调用约定不一致
+template <typename V>
+[[gnu::always_inline]] inline void load_lanes(V& dst, const BitsetType* src) noexcept
+{
+    std::memcpy(&dst, src, sizeof(V));
+}
+
+template <typename V>
+[[gnu::always_inline]] inline void store_lanes(BitsetType* dst, const V& v) noexcept
+{
+    std::memcpy(dst, &v, sizeof(V));
+}
+
+template <typename V>
+[[gnu::always_inline]] inline bool any_lane(const V& v) noexcept
+{
+    std::uint64_t words[sizeof(V) / 8];
+    std::memcpy(words, &v, sizeof(V));
+    std::uint64_t res = 0;
+    for (const std::uint64_t w : words) res |= w;
+    return res != 0;
+}
+
+
+
+template <int L>
+[[gnu::always_inline]] inline void solve_group(LaneGroup& g)
+{
+    using V = typename LaneVector<L>::type;
+    const int w = g.width;
+    const int n = g.height * g.width;
+    const int k = g.count;
+    std::vector<int>& trail_pos = *g.trail_pos;
+    std::vector<BitsetType>& trail_old = *g.trail_old;
+
+    V bits[32];
+    V weights[32];
+    V sups[4][32];
+    for (int t = 0; t < k; ++t) {
+        bits[t] = V{} + (1u << t);
+        weights[t] = V{} + g.weights[t];
+        for (int d = 0; d < 4; ++d) {
+            sups[d][t] = V{} + g.support[d * k + t];
+        }
+    }
+    V state;
+    load_lanes(state, g.states);
+    // 不参与求解的通道恒为全 1，施加约束时不会变化
+    V dead{};
+    for (int l = 0; l < L; ++l) {
+        if (!(g.active >> l & 1u)) dead[l] = ~0u;
+    }
+
+    // 撤销记录只在一步之内使用，按需扩大后保留
+    std::size_t trail = 0;
+    auto cell = [&g](int idx) { return g.cells + std::size_t(idx) * L; };
+    auto record = [&](int idx, const V& old) {
+        if (trail == trail_pos.size()) [[unlikely]] {
+            trail_pos.resize(2 * trail + 64);
+            trail_old.resize(trail_pos.size() * L);
+        }
+        trail_pos[trail] = idx;
+        store_lanes(trail_old.data() + trail * L, old);
+        ++trail;
+    };
+
+    for (int pos = 0; pos < n && g.active; ++pos) {
+        V cur;
+        load_lanes(cur, cell(pos));
+        const V need = (V)((cur & (cur - 1)) != 0) & ~dead;
+        if (!any_lane(need)) continue;
+
+        // 需要决定的通道各自推进 xorshift，按权重选取图块：r 为 [0, 权重之和) 中的随机数，取前缀和首次超过 r 的图块
+        V next = state ^ (state << 13);
+        next ^= next >> 17;
+        next ^= next << 5;
+        state = (need & next) | (~need & state);
+        V part[32];
+        V total{};
+        for (int t = 0; t < k; ++t) {
+            part[t] = (V)((cur & bits[t]) != 0) & weights[t];
+            total += part[t];
+        }
+        const V r = ((state >> 16) * total) >> 16;
+        V acc{}, found{}, pick{};
+        for (int t = 0; t < k; ++t) {
+            acc += part[t];
+            const V hit = (V)(acc > r) & ~found;
+            pick |= hit & bits[t];
+            found |= hit;
+        }
+        // 权重全为 0 时取编号最小的图块
+        pick |= ~found & (cur & (0u - cur));
+        const V chosen = (need & pick) | (~need & cur);
+
+        trail = 0;
+        record(pos, cur);
+        store_lanes(cell(pos), chosen);
+        int top = 0;
+        g.queue[top++] = pos;
+        g.queued[pos] = 1;
+        unsigned failed = 0;
+
+        while (top > 0) {
+            const int idx = g.queue[--top];
+            g.queued[idx] = 0;
+            V src;
+            load_lanes(src, cell(idx));
+            V sel[32];
+            for (int t = 0; t < k; ++t) {
+                sel[t] = (V)((src & bits[t]) != 0);
+            }
+            const int y = idx / w;
+            const int x = idx - y * w;
+            // DIR4 的顺序：上、左、右、下
+            const bool has[4] = {y > 0, x > 0, x + 1 < w, idx + w < n};
+            const int target[4] = {idx - w, idx - 1, idx + 1, idx + w};
+            for (int d = 0; d < 4; ++d) {
+                if (!has[d]) continue;
+                V valid = dead;
+                for (int t = 0; t < k; ++t) {
+                    valid |= sel[t] & sups[d][t];
+                }
+                const int nb = target[d];
+                V old;
+                load_lanes(old, cell(nb));
+                const V res = old & valid;
+                if (!any_lane(res ^ old)) continue;
+                record(nb, old);
+                store_lanes(cell(nb), res);
+                const V empty = (V)(res == 0);
+                if (any_lane(empty)) [[unlikely]] {
+                    for (int l = 0; l < L; ++l) {
+                        if (empty[l]) {
+                            failed |= 1u << l;
+                            dead[l] = ~0u;
+                        }
+                    }
+                }
+                if (!g.queued[nb]) {
+                    g.queued[nb] = 1;
+                    g.queue[top++] = nb;
+                }
+            }
+        }
+        if (!failed) [[likely]] continue;
+
+        // 只撤销失败的通道在这一步的修改，去掉失败的图块后离开同步求解
+        for (std::size_t i = trail; i-- > 0; ) {
+            BitsetType* dst = cell(trail_pos[i]);
+            const BitsetType* old = trail_old.data() + i * L;
+            for (unsigned rest = failed; rest; rest &= rest - 1) {
+                const int l = std::countr_zero(rest);
+                dst[l] = old[l];
+            }
+        }
+        for (unsigned rest = failed; rest; rest &= rest - 1) {
+            const int l = std::countr_zero(rest);
+            BitsetType* out = g.retired + std::size_t(l) * n;
+            for (int idx = 0; idx < n; ++idx) {
+                out[idx] = cell(idx)[l];
+            }
+            out[pos] &= ~chosen[l];
+        }
+        g.active &= ~failed;
+    }
+}
+
+
+
+/*
+ * 由种子得到通道的 xorshift 初始状态（murmur3 的 fmix32），不能为 0
+ */
+std::uint32_t lane_seed(std::uint32_t seed) noexcept
+{
+    seed ^= seed >> 16;
+    seed *= 0x85ebca6bu;
+    seed ^= seed >> 13;
+    seed *= 0xc2b2ae35u;
+    seed ^= seed >> 16;
+    return seed ? seed : 1u;
+}
+
+
+
+using GroupFunc = void (*)(LaneGroup&);
+
+struct Kernel
+{
+    GroupFunc func;
+    int lanes;
+};
+
+void solve_generic(LaneGroup& g)
+{
+    solve_group<8>(g);
+}
+
+#ifdef CHA_SIMD_X86
+
+__attribute__((target("avx2")))
+void solve_avx2(LaneGroup& g)
+{
+    solve_group<8>(g);
+}
+
+__attribute__((target("avx512f")))
+void solve_avx512(LaneGroup& g)
+{
+    solve_group<16>(g);
+}
+
+#endif
+
+
+
+Kernel select_kernel() noexcept
+{
+#ifdef CHA_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return {solve_avx512, 16};
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return {solve_avx2, 8};
+    }
+#endif
+    return {solve_generic, 8};
+}
+
+
+
+const Kernel& kernel() noexcept
+{
+    static const Kernel res = select_kernel();
+    return res;
+}
+
+} // namespace
+
+
+
+int BatchCollapse::getLanes() noexcept
+{
+    return kernel().lanes;
+}
+
+
+
+bool BatchCollapse::generate(std::span<const std::uint32_t> seeds, std::vector<Matrix<FactorType>>& out)
+{
+    fallbacks_ = 0;
+    out.assign(seeds.size(), Matrix<FactorType>(size_.y, size_.x, -1));
+    if (initial_.empty()) {
+        return seeds.empty();
+    }
+
+    const int lanes = getLanes();
+    const std::size_t n = initial_.size();
+    cells_.resize(n * lanes);
+    retired_.resize(n * lanes);
+    queue_.resize(n);
+    queued_.assign(n, 0);
+    std::vector<std::uint32_t> states(lanes, 1u);
+
+    bool ok = true;
+    for (std::size_t first = 0; first < seeds.size(); first += lanes) {
+        const int m = static_cast<int>(std::min<std::size_t>(lanes, seeds.size() - first));
+        for (std::size_t idx = 0; idx < n; ++idx) {
+            std::fill_n(cells_.begin() + idx * lanes, lanes, initial_[idx]);
+        }
+        for (int l = 0; l < m; ++l) {
+            states[l] = lane_seed(seeds[first + l]);
+        }
+
+        LaneGroup group{size_.y, size_.x, static_cast<int>(weights_.size()), support_.data(), lane_weights_.data(),
+                        cells_.data(), retired_.data(), states.data(), queue_.data(), queued_.data(),
+                        &trail_pos_, &trail_old_, (1u << m) - 1u};
+        kernel().func(group);
+
+        for (int l = 0; l < m; ++l) {
+            Matrix<FactorType>& map = out[first + l];
+            if (group.active >> l & 1u) {
+                for (std::size_t idx = 0; idx < n; ++idx) {
+                    map[idx] = std::countr_zero(cells_[idx * lanes + l]);
+                }
+            } else {
+                ++fallbacks_;
+                ok &= solveScalar_(&retired_[std::size_t(l) * n], seeds[first + l], map);
+            }
+        }
+    }
+    return ok;
+}
+
+
+
+/*
+ * 标量求解：先从离开同步求解时的状态接着求解，失败时再换种子从头求解
+ */
+bool BatchCollapse::solveScalar_(const BitsetType* domains, std::uint32_t seed, Matrix<FactorType>& out)
+{
+    for (int attempt = 0; attempt < RETRIES; ++attempt) {
+        fallback_.reset(seed ^ (attempt + 1u) * 0x9e3779b9u);
+        if (attempt == 0) {
+            std::vector<std::pair<Int2, BitsetType>> presets;
+            for (std::size_t idx = 0; idx < initial_.size(); ++idx) {
+                if (domains[idx] != initial_[idx]) {
+                    presets.emplace_back(Int2(static_cast<int>(idx) / size_.x, static_cast<int>(idx) % size_.x), domains[idx]);
+                }
+            }
+            if (!fallback_.set(presets)) continue;
+        }
+        if (!fallback_.solveWithin()) continue;
+        for (const Int2 pos : Int2::Range(size_)) {
+            out[pos] = WaveFunctionCollapse::toFactor(fallback_.get(pos));
+        }
+        return true;
+    }
+    return false;
+}
+
+
+
+} // namespace cha
@@ -0,0 +1,362 @@
+#include "wfc_cache.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+#include "tools/fnv_hash.hpp"
+namespace cha
+{
+
+
+
+/*
+ * 文件格式：8 字节的文件头，之后为依次追加的记录
+ * 每条记录为 RecordHeader、presets 个 PresetRecord 与 rows * cols 字节的图块，按 8 字节对齐
+ * length 为 RecordHeader 之后的字节数（不含对齐）
+ */
+static constexpr char FILE_MAGIC[8] = {'W', 'F', 'C', 'C', 'A', 'C', 'H', '2'};
+static constexpr std::uint32_t RECORD_MAGIC = 0x52434657u;
+
+struct RecordHeader
+{
+    std::uint32_t magic;
+    std::uint32_t length;
+    std::uint64_t key;
+    std::uint64_t rule_hash;
+    std::int32_t rows;
+    std::int32_t cols;
+    std::uint32_t seed;
+    std::uint32_t presets;
+};
+static_assert(sizeof(RecordHeader) == 40);
+
+struct PresetRecord
+{
+    std::int32_t y;
+    std::int32_t x;
+    MapCache::BitsetType mask;
+};
+static_assert(sizeof(PresetRecord) == 12);
+
+static constexpr std::size_t padded(std::size_t length) noexcept
+{
+    return (length + 7) & ~std::size_t(7);
+}
+
+
+
+static std::size_t payload_length(std::size_t presets, Int2 size) noexcept
+{
+    return presets * sizeof(PresetRecord) + std::size_t(size.y) * std::size_t(size.x);
+}
+
+
+
+/*
+ * 记录保存的规则哈希与请求参数是否与查询的完全相同
+ */
+static bool matches(const std::uint8_t* record, std::uint64_t rule_hash, Int2 size, std::uint32_t seed,
+                    std::span<const std::pair<Int2, MapCache::BitsetType>> presets)
+{
+    RecordHeader header;
+    std::memcpy(&header, record, sizeof(header));
+    if (header.rule_hash != rule_hash || header.rows != size.y || header.cols != size.x
+        || header.seed != seed || header.presets != presets.size()) {
+        return false;
+    }
+    const std::uint8_t* ptr = record + sizeof(RecordHeader);
+    for (const auto& [pos, mask] : presets) {
+        PresetRecord preset;
+        std::memcpy(&preset, ptr, sizeof(preset));
+        if (preset.y != pos.y || preset.x != pos.x || preset.mask != mask) {
+            return false;
+        }
+        ptr += sizeof(PresetRecord);
+    }
+    return true;
+}
+
+
+
+MapCache::MapCache(std::string path, std::size_t capacity, bool overwrite)
+    : path_(std::move(path)), capacity_(capacity)
+{
+    open_(overwrite);
+}
+
+
+
+MapCache::~MapCache()
+{
+    if (file_) {
+        std::fclose(file_);
+    }
+}
+
+
+
+std::uint64_t MapCache::keyOf(std::uint64_t rule_hash, Int2 size, std::uint32_t seed,
+                              std::span<const std::pair<Int2, BitsetType>> presets)
+{
+    if (rule_hash == 0) {
+        return 0;
+    }
+    FnvHash hash;
+    hash.add(rule_hash);
+    hash.add(size);
+    hash.add(seed);
+    hash.add(presets.size());
+    for (const auto& [pos, mask] : presets) {
+        hash.add(pos);
+        hash.add(mask);
+    }
+    const std::uint64_t res = hash.value();
+    return res ? res : 1;
+}
+
+
+
+/*
+ * 打开文件并扫描记录头建立索引
+ * 文件不存在或为空时创建；文件头不符时只有 overwrite 才重新创建，否则不碰这个文件
+ */
+bool MapCache::open_(bool overwrite)
+{
+    std::error_code ec;
+    const bool empty = !std::filesystem::exists(path_, ec) || std::filesystem::file_size(path_, ec) == 0;
+    MappedFile map;
+    if (!empty) {
+        map = MappedFile(path_);
+        const bool valid = map.isOpen() && map.size() >= sizeof(FILE_MAGIC)
+            && std::memcmp(map.data(), FILE_MAGIC, sizeof(FILE_MAGIC)) == 0;
+        if (!valid && !overwrite) {
+            return false;
+        }
+        if (!valid) map = MappedFile();
+    }
+    if (!map.isOpen()) {
+        std::FILE* file = std::fopen(path_.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        const bool ok = std::fwrite(FILE_MAGIC, sizeof(FILE_MAGIC), 1, file) == 1;
+        std::fclose(file);
+        if (!ok) {
+            return false;
+        }
+        bytes_ = sizeof(FILE_MAGIC);
+    } else {
+        std::size_t offset = sizeof(FILE_MAGIC);
+        while (offset + sizeof(RecordHeader) <= map.size()) {
+            RecordHeader header;
+            std::memcpy(&header, map.data() + offset, sizeof(header));
+            const std::size_t end = offset + sizeof(RecordHeader) + padded(header.length);
+            if (header.magic != RECORD_MAGIC || end > map.size() || header.rows <= 0 || header.cols <= 0
+                || header.length != payload_length(header.presets, Int2(header.rows, header.cols))) {
+                break;
+            }
+            index_.try_emplace(header.key, offset, end - offset, 0);
+            offset = end;
+        }
+        bytes_ = offset;
+        // 截掉上次写入时中断的不完整记录
+        if (offset < map.size()) {
+            map = MappedFile();
+            std::filesystem::resize_file(path_, offset, ec);
+        }
+    }
+
+    file_ = std::fopen(path_.c_str(), "ab");
+    remap_();
+    return file_ != nullptr;
+}
+
+
+
+void MapCache::remap_()
+{
+    map_ = std::make_shared<const MappedFile>(path_);
+}
+
+
+
+MapCache::Entry MapCache::find(std::uint64_t rule_hash, Int2 size, std::uint32_t seed,
+                               std::span<const std::pair<Int2, BitsetType>> presets)
+{
+    const std::uint64_t key = keyOf(rule_hash, size, seed, presets);
+    if (key == 0) {
+        return {};
+    }
+    auto lookup = [&, this]() -> std::pair<Entry, bool> {
+        const auto it = index_.find(key);
+        if (it == index_.end()) {
+            return {{}, true};
+        }
+        Slot& slot = it->second;
+        if (!map_ || slot.offset + slot.length > map_->size()) {
+            return {{}, false};
+        }
+        const std::uint8_t* record = map_->data() + slot.offset;
+        if (!matches(record, rule_hash, size, seed, presets)) {
+            // 键的碰撞，当作未命中
+            return {{}, true};
+        }
+        slot.used.store(++clock_, std::memory_order_relaxed);
+        const std::size_t begin = sizeof(RecordHeader) + presets.size() * sizeof(PresetRecord);
+        return {{map_, size, std::span(record + begin, std::size_t(size.y) * size.x)}, true};
+    };
+
+    {
+        std::shared_lock lock(mutex_);
+        if (auto [entry, done] = lookup(); done) {
+            return entry;
+        }
+    }
+    // 记录在上次映射之后写入，重新映射
+    std::unique_lock lock(mutex_);
+    if (auto [entry, done] = lookup(); done) {
+        return entry;
+    }
+    remap_();
+    return lookup().first;
+}
+
+
+
+bool MapCache::insert(std::uint64_t rule_hash, Int2 size, std::uint32_t seed,
+                      std::span<const std::pair<Int2, BitsetType>> presets, std::span<const std::uint8_t> tiles)
+{
+    const std::uint64_t key = keyOf(rule_hash, size, seed, presets);
+    if (key == 0 || size.y <= 0 || size.x <= 0 || tiles.size() != std::size_t(size.y) * size.x) {
+        return false;
+    }
+    std::vector<PresetRecord> records;
+    records.reserve(presets.size());
+    for (const auto& [pos, mask] : presets) {
+        records.push_back(PresetRecord{pos.y, pos.x, mask});
+    }
+    const std::size_t length = payload_length(presets.size(), size);
+
+    std::unique_lock lock(mutex_);
+    if (!file_) {
+        return false;
+    }
+    if (index_.contains(key)) {
+        return true;
+    }
+
+    const RecordHeader header{RECORD_MAGIC, static_cast<std::uint32_t>(length), key, rule_hash, size.y, size.x,
+                              seed, static_cast<std::uint32_t>(records.size())};
+    static constexpr char zeros[8] = {};
+    const std::size_t pad = padded(length) - length;
+    const bool ok = std::fwrite(&header, sizeof(header), 1, file_) == 1
+        && std::fwrite(records.data(), sizeof(PresetRecord), records.size(), file_) == records.size()
+        && std::fwrite(tiles.data(), 1, tiles.size(), file_) == tiles.size()
+        && std::fwrite(zeros, 1, pad, file_) == pad
+        && std::fflush(file_) == 0;
+    if (!ok) {
+        // 文件末尾可能留下不完整的记录，之后不再写入，下次打开时截掉
+        std::fclose(file_);
+        file_ = nullptr;
+        return false;
+    }
+    const std::size_t record = sizeof(RecordHeader) + padded(length);
+    index_.try_emplace(key, bytes_, record, ++clock_);
+    bytes_ += record;
+    if (bytes_ > capacity_) {
+        compact_();
+    }
+    return true;
+}
+
+
+
+std::size_t MapCache::count() const
+{
+    std::shared_lock lock(mutex_);
+    return index_.size();
+}
+
+
+
+std::size_t MapCache::bytes() const
+{
+    std::shared_lock lock(mutex_);
+    return bytes_;
+}
+
+
+
+/*
+ * 按最近使用的顺序保留记录，直到占用一半容量，写入临时文件后替换原文件
+ * Windows 上不能替换仍被映射的文件，替换前释放自己的映射；
+ * 已经返回的 Entry 仍持有旧的映射时替换失败，保留原文件，下次写入时再试
+ * 调用者持有写锁
+ */
+bool MapCache::compact_()
+{
+    remap_();
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> order;
+    order.reserve(index_.size());
+    for (const auto& [key, slot] : index_) {
+        order.emplace_back(slot.used.load(std::memory_order_relaxed), key);
+    }
+    std::sort(order.begin(), order.end(), std::greater<>());
+
+    std::vector<std::uint64_t> keep;
+    std::size_t total = sizeof(FILE_MAGIC);
+    for (const auto& [used, key] : order) {
+        const std::size_t record = index_.at(key).length;
+        if (total + record > capacity_ / 2) break;
+        total += record;
+        keep.push_back(key);
+    }
+    // 按原来的位置写出，保持文件内的顺序
+    std::sort(keep.begin(), keep.end(), [this](std::uint64_t a, std::uint64_t b) {
+        return index_.at(a).offset < index_.at(b).offset;
+    });
+
+    const std::string tmp = path_ + ".tmp";
+    std::FILE* out = std::fopen(tmp.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+    bool ok = std::fwrite(FILE_MAGIC, sizeof(FILE_MAGIC), 1, out) == 1;
+    std::vector<std::pair<std::uint64_t, std::size_t>> offsets;
+    std::size_t offset = sizeof(FILE_MAGIC);
+    for (const std::uint64_t key : keep) {
+        const Slot& slot = index_.at(key);
+        ok = ok && std::fwrite(map_->data() + slot.offset, 1, slot.length, out) == slot.length;
+        offsets.emplace_back(key, offset);
+        offset += slot.length;
+    }
+    ok = std::fclose(out) == 0 && ok;
+
+    std::error_code ec;
+    if (ok) {
+        map_.reset();
+        std::fclose(file_);
+        std::filesystem::rename(tmp, path_, ec);
+        file_ = std::fopen(path_.c_str(), "ab");
+    }
+    if (!ok || ec) {
+        std::filesystem::remove(tmp, ec);
+        remap_();
+        return false;
+    }
+
+    std::unordered_map<std::uint64_t, Slot> index;
+    for (const auto& [key, new_offset] : offsets) {
+        const Slot& slot = index_.at(key);
+        index.try_emplace(key, new_offset, slot.length, slot.used.load(std::memory_order_relaxed));
+    }
+    index_.swap(index);
+    bytes_ = offset;
+    remap_();
+    return true;
+}
+
+
+
+} // namespace cha
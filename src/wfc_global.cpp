@@ -0,0 +1,413 @@
+#include "wfc_global.h"
+#include <algorithm>
+#include <bit>
+#include <span>
+#include "tools/fnv_hash.hpp"
+namespace cha
+{
+
+
+
+void GlobalConstraints::setCount(FactorType tile, int min, int max)
+{
+    if (std::size_t(tile) >= min_.size()) {
+        min_.resize(tile + 1, 0);
+        max_.resize(tile + 1, INT_MAX);
+    }
+    min_[tile] = min;
+    max_[tile] = max;
+}
+
+
+
+void GlobalConstraints::clear()
+{
+    links_.clear();
+    connected_ = false;
+    paths_.clear();
+    min_.clear();
+    max_.clear();
+}
+
+
+
+/*
+ * 开始求解时重建状态：所有格子视为全集，之后由求解器对每个格子调用 change_() 并以位置 0 提交
+ */
+void GlobalConstraints::start_(const WaveFunctionCollapse& wfc)
+{
+    topology_ = &wfc.getTopology();
+    const int cells = topology_->cellCount();
+    const FactorType factors = wfc.getFactorCount();
+
+    linked_ = 0;
+    for (FactorType t = 0; t < std::min<FactorType>(factors, links_.size()); ++t) {
+        if (links_[t]) linked_ |= 1u << t;
+    }
+    // 端点换算为存储位置，超出地图的端点记为 -1，检查时直接视为违反
+    const Int3 size = topology_->size();
+    auto cell_of = [&wfc, size](Int3 pos) {
+        const bool inside = pos.z >= 0 && pos.z < size.z && pos.y >= 0 && pos.y < size.y && pos.x >= 0 && pos.x < size.x;
+        return inside ? static_cast<int>(wfc.index_(pos)) : -1;
+    };
+    path_cells_.clear();
+    for (const auto& [a, b] : paths_) {
+        path_cells_.emplace_back(cell_of(a), cell_of(b));
+    }
+
+    known_.assign(cells, static_cast<int>(wfc.getFactorMask()));
+    decided_.assign(factors, 0);
+    possible_.assign(factors, cells);
+    parent_.assign(cells, 0);
+    count_.assign(cells, 0);
+    open_.assign(cells, 0);
+    components_ = 0;
+    closed_ = 0;
+    journal_.clear();
+    checkpoints_.clear();
+    reach_mark_.assign(cells, 0);
+    reach_owner_.assign(cells, 0);
+    reach_queue_.reserve(cells);
+    searches_.reserve(cells);
+    epoch_ = 0;
+    changed_.clear();
+    changed_.reserve(cells);
+    full_ = true;
+}
+
+
+
+/*
+ * 报告格子 idx 当前的状态，可能性只会减少；同一个格子重复报告相同的状态时忽略
+ */
+void GlobalConstraints::change_(int idx, BitsetType bitset)
+{
+    const BitsetType old = static_cast<BitsetType>(known_[idx]);
+    if (old == bitset) return;
+    changed_.push_back(idx);
+    set_(known_[idx], static_cast<int>(bitset));
+    for (BitsetType removed = old & ~bitset; removed; removed &= removed - 1) {
+        const int t = std::countr_zero(removed);
+        set_(possible_[t], possible_[t] - 1);
+    }
+    if (!std::has_single_bit(old) && std::has_single_bit(bitset)) {
+        decide_(idx, std::countr_zero(bitset));
+    }
+}
+
+
+
+/*
+ * 格子 idx 决定为图块 factor
+ * 连通的图块成为新的连通块，开口数量为通向未决定格子的连通方向数；
+ * 已决定的邻居中连通到本格子的，其开口减一，双方互相连通时合并
+ */
+void GlobalConstraints::decide_(int idx, FactorType factor)
+{
+    set_(decided_[factor], decided_[factor] + 1);
+    if (links_.empty()) return;
+
+    auto links_of = [this](int cell) -> BitsetType {
+        const FactorType t = std::countr_zero(static_cast<BitsetType>(known_[cell]));
+        return std::size_t(t) < links_.size() ? links_[t] : 0u;
+    };
+    const BitsetType links = links_of(idx);
+    if (links) {
+        int open = 0;
+        topology_->visit(idx, [&](int target, int label) {
+            if ((links >> label & 1u) && !std::has_single_bit(static_cast<BitsetType>(known_[target]))) ++open;
+            return true;
+        });
+        set_(parent_[idx], idx);
+        set_(count_[idx], 1);
+        set_(open_[idx], open);
+        set_(components_, components_ + 1);
+        if (open == 0) set_(closed_, closed_ + 1);
+    }
+
+    topology_->visit(idx, [&](int target, int label) {
+        if (target == idx || !std::has_single_bit(static_cast<BitsetType>(known_[target]))) return true;
+        const BitsetType target_links = links_of(target);
+        if (!target_links) return true;
+        bool back = false;
+        topology_->visit(target, [&](int cell, int l) {
+            back = cell == idx && (target_links >> l & 1u);
+            return !back;
+        });
+        if (!back) return true;
+        const int root = find_(target);
+        setOpen_(root, open_[root] - 1);
+        if (links >> label & 1u) unite_(idx, target);
+        return true;
+    });
+}
+
+
+
+int GlobalConstraints::find_(int idx) const noexcept
+{
+    while (parent_[idx] != idx) idx = parent_[idx];
+    return idx;
+}
+
+
+
+void GlobalConstraints::setOpen_(int root, int open)
+{
+    const int closed = closed_ - (open_[root] == 0) + (open == 0);
+    set_(open_[root], open);
+    if (closed != closed_) set_(closed_, closed);
+}
+
+
+
+void GlobalConstraints::unite_(int a, int b)
+{
+    a = find_(a);
+    b = find_(b);
+    if (a == b) return;
+    if (count_[a] < count_[b]) std::swap(a, b);
+    const int open = open_[a] + open_[b];
+    const int closed = closed_ - (open_[a] == 0) - (open_[b] == 0) + (open == 0);
+    set_(parent_[b], a);
+    set_(count_[a], count_[a] + count_[b]);
+    set_(open_[a], open);
+    set_(components_, components_ - 1);
+    if (closed != closed_) set_(closed_, closed);
+}
+
+
+
+/*
+ * 封闭的块不会再增长：要求整体连通时，存在封闭的块且块数多于一个即违反；
+ * 通路的端点所在的块封闭而另一端不在其中即违反
+ */
+bool GlobalConstraints::check_() const
+{
+    if (connected_ && closed_ > 0 && components_ > 1) {
+        return false;
+    }
+    for (std::size_t t = 0; t < std::min(min_.size(), possible_.size()); ++t) {
+        if (possible_[t] < min_[t] || decided_[t] > max_[t]) return false;
+    }
+    auto sealed = [this](int from, int to) {
+        if (!std::has_single_bit(static_cast<BitsetType>(known_[from]))) return false;
+        const int root = find_(from);
+        return open_[root] == 0 && !(std::has_single_bit(static_cast<BitsetType>(known_[to])) && find_(to) == root);
+    };
+    for (const auto& [a, b] : path_cells_) {
+        if (a < 0 || b < 0) return false;
+        if (!(static_cast<BitsetType>(known_[a]) & linked_) || !(static_cast<BitsetType>(known_[b]) & linked_)) return false;
+        if (sealed(a, b) || sealed(b, a)) return false;
+    }
+
+    // 封闭之前也要检查：已决定的连通块之间、通路的两端之间是否还能经由未决定的格子相连
+    return checkReach_();
+}
+
+
+
+/*
+ * 可能连通的格子组成的图：两端都可能是连通的图块，已决定的一端在这条边的方向上连通
+ * 这是实际连通性的上界，不连通即一定无法相连
+ */
+bool GlobalConstraints::passable_(int from, int label, int to) const
+{
+    auto links_of = [this](int cell) -> BitsetType {
+        const BitsetType known = static_cast<BitsetType>(known_[cell]);
+        if (!std::has_single_bit(known)) return ~0u;
+        const FactorType t = std::countr_zero(known);
+        return t < static_cast<FactorType>(links_.size()) ? links_[t] : 0u;
+    };
+    if (!(static_cast<BitsetType>(known_[to]) & linked_) || !(links_of(from) >> label & 1u)) {
+        return false;
+    }
+    const BitsetType back = links_of(to);
+    if (back == ~0u) {
+        return true;
+    }
+    bool res = false;
+    topology_->visit(to, [&](int cell, int l) {
+        res = cell == from && (back >> l & 1u);
+        return !res;
+    });
+    return res;
+}
+
+
+
+int GlobalConstraints::findSearch_(int search) const noexcept
+{
+    while (searches_[search].parent != search) {
+        search = searches_[search].parent = searches_[searches_[search].parent].parent;
+    }
+    return search;
+}
+
+
+
+/*
+ * 上一次提交时的状态满足要求：所有已决定的连通格子在上面的图中属于同一块，每条通路的两端属于同一块
+ * 这一步只删去了与改动过的格子相关的边，如果某一块因此与其余部分分开，它一定含有改动过的格子或者它们的邻居；
+ * 从这些格子同时开始搜索，相遇的搜索合并，搜索完的块必须包含全部或不含已决定的连通格子、同时包含或不含通路的两端，
+ * 只剩一个搜索时其余的块都已检查过，可以停止
+ */
+bool GlobalConstraints::checkReach_() const
+{
+    bool paths = false;
+    for (const auto& [a, b] : path_cells_) {
+        paths = paths || !(std::has_single_bit(static_cast<BitsetType>(known_[a]))
+            && std::has_single_bit(static_cast<BitsetType>(known_[b])) && find_(a) == find_(b));
+    }
+    const bool connected = connected_ && components_ > 1;
+    if (!connected && !paths) {
+        return true;
+    }
+    int total = 0;
+    for (FactorType t = 0; t < static_cast<FactorType>(decided_.size()); ++t) {
+        if (linked_ >> t & 1u) total += decided_[t];
+    }
+
+    const unsigned epoch = ++epoch_;
+    reach_queue_.clear();
+    searches_.clear();
+    auto decided_link = [this](int cell) {
+        const BitsetType known = static_cast<BitsetType>(known_[cell]);
+        return std::has_single_bit(known) && (known & linked_) ? 1 : 0;
+    };
+    auto seed = [&](int cell) {
+        if (reach_mark_[cell] == epoch || !(static_cast<BitsetType>(known_[cell]) & linked_)) return true;
+        reach_mark_[cell] = epoch;
+        reach_owner_[cell] = static_cast<int>(searches_.size());
+        searches_.push_back({static_cast<int>(searches_.size()), 1, decided_link(cell)});
+        reach_queue_.push_back(cell);
+        return true;
+    };
+    if (full_) {
+        for (int cell = 0; cell < static_cast<int>(known_.size()); ++cell) seed(cell);
+    } else {
+        for (const int cell : changed_) {
+            seed(cell);
+            topology_->visit(cell, [&](int target, int) { return seed(target); });
+        }
+    }
+
+    // 搜索完的块 root 是一个完整的连通部分
+    auto closed_ok = [&](int root) {
+        const int decided = searches_[root].decided;
+        if (connected && decided > 0 && decided < total) return false;
+        auto inside = [&](int cell) {
+            return reach_mark_[cell] == epoch && findSearch_(reach_owner_[cell]) == root;
+        };
+        for (const auto& [a, b] : path_cells_) {
+            if (inside(a) != inside(b)) return false;
+        }
+        return true;
+    };
+    int alive = static_cast<int>(searches_.size());
+    for (std::size_t head = 0; head < reach_queue_.size() && alive > 1; ++head) {
+        const int idx = reach_queue_[head];
+        int root = findSearch_(reach_owner_[idx]);
+        topology_->visit(idx, [&](int target, int label) {
+            if (!passable_(idx, label, target)) return true;
+            if (reach_mark_[target] != epoch) {
+                reach_mark_[target] = epoch;
+                reach_owner_[target] = root;
+                ++searches_[root].pending;
+                searches_[root].decided += decided_link(target);
+                reach_queue_.push_back(target);
+                return true;
+            }
+            const int other = findSearch_(reach_owner_[target]);
+            if (other != root) {
+                searches_[other].parent = root;
+                searches_[root].pending += searches_[other].pending;
+                searches_[root].decided += searches_[other].decided;
+                --alive;
+            }
+            return true;
+        });
+        if (--searches_[root].pending == 0) {
+            if (!closed_ok(root)) return false;
+            --alive;
+        }
+    }
+    return true;
+}
+
+
+
+/*
+ * 所有约束设置的哈希值，计入求解器的 getRuleHash()
+ */
+std::uint64_t GlobalConstraints::hash_() const
+{
+    FnvHash hash;
+    hash.add(std::span(links_));
+    hash.add(connected_);
+    hash.add(std::span(paths_));
+    hash.add(std::span(min_));
+    hash.add(std::span(max_));
+    return hash.value();
+}
+
+
+
+bool GlobalConstraints::commit_(std::size_t position)
+{
+    checkpoints_.emplace_back(position, journal_.size());
+    const bool ok = check_();
+    changed_.clear();
+    full_ = false;
+    return ok;
+}
+
+
+
+/*
+ * 撤销到撤销记录长度为 position 时的状态，position 必须是之前提交过的位置
+ */
+void GlobalConstraints::rollback_(std::size_t position)
+{
+    while (!checkpoints_.empty() && checkpoints_.back().first > position) {
+        checkpoints_.pop_back();
+    }
+    const std::size_t target = checkpoints_.empty() ? 0 : checkpoints_.back().second;
+    while (journal_.size() > target) {
+        const auto [slot, value] = journal_.back();
+        *slot = value;
+        journal_.pop_back();
+    }
+    changed_.clear();
+}
+
+
+
+/*
+ * 求解器重新开始时调用，释放回溯之后日志多余的容量
+ */
+void GlobalConstraints::release_()
+{
+    journal_.shrink_to_fit();
+    checkpoints_.shrink_to_fit();
+}
+
+
+
+/*
+ * 日志与检查点随搜索深度增长，计入撤销记录；其余按格子数量分配的状态计入临时内存
+ */
+void GlobalConstraints::memoryUsage_(WaveFunctionCollapse::MemoryUsage& usage) const
+{
+    auto bytes = []<typename T>(const std::vector<T>& v) {
+        return v.capacity() * sizeof(T);
+    };
+    usage.undo += bytes(journal_) + bytes(checkpoints_);
+    usage.scratch += bytes(path_cells_) + bytes(known_) + bytes(decided_) + bytes(possible_)
+        + bytes(parent_) + bytes(count_) + bytes(open_) + bytes(reach_mark_) + bytes(reach_owner_) + bytes(reach_queue_)
+        + bytes(searches_) + bytes(changed_);
+}
+
+
+
+} // namespace cha
@@ -0,0 +1,232 @@
+#include "wfc_hier.h"
+#include <algorithm>
+#include <random>
+#include "tools/thread_pool.hpp"
+namespace cha
+{
+
+
+
+static std::vector<Int3> dir4_list()
+{
+    return std::vector<Int3>(std::begin(DIR4), std::end(DIR4));
+}
+
+
+
+HierarchicalCollapse::HierarchicalCollapse(Int2 size, int block, std::vector<BitsetType> support,
+                                           std::vector<WeightType> weights, std::uint32_t seed)
+    : size_(size), block_(block), seed_(seed), support_(std::move(support)), weights_(std::move(weights)),
+      map_(size.y, size.x, -1) {}
+
+
+
+/*
+ * 按接口集合推导元图块：每个不同的接口集合一个元图块，包含接口集合是其子集的细图块
+ */
+std::vector<HierarchicalCollapse::BitsetType> HierarchicalCollapse::classesOf_(std::vector<std::vector<int>> sockets)
+{
+    for (auto& set : sockets) {
+        std::sort(set.begin(), set.end());
+        set.erase(std::unique(set.begin(), set.end()), set.end());
+    }
+    std::vector<std::vector<int>> keys = sockets;
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    std::vector<BitsetType> res;
+    for (const auto& key : keys) {
+        BitsetType mask = 0u;
+        for (int t = 0; t < static_cast<int>(sockets.size()); ++t) {
+            if (std::includes(key.begin(), key.end(), sockets[t].begin(), sockets[t].end())) {
+                mask |= 1u << t;
+            }
+        }
+        res.push_back(mask);
+    }
+    return res;
+}
+
+
+
+void HierarchicalCollapse::setClasses(std::vector<BitsetType> classes)
+{
+    classes_ = std::move(classes);
+    const int n = static_cast<int>(classes_.size());
+    const int k = static_cast<int>(weights_.size());
+    coarse_support_.assign(4 * n, 0u);
+    for (int d = 0; d < 4; ++d) {
+        for (int a = 0; a < n; ++a) {
+            // 元图块 a 中所有细图块在方向 d 上允许的邻居
+            BitsetType valid = 0u;
+            for (int t = 0; t < k; ++t) {
+                if (classes_[a] >> t & 1u) valid |= support_[d * k + t];
+            }
+            for (int b = 0; b < n; ++b) {
+                if (valid & classes_[b]) coarse_support_[d * n + a] |= 1u << b;
+            }
+        }
+    }
+}
+
+
+
+void HierarchicalCollapse::setCoarseRule(std::vector<BitsetType> support)
+{
+    coarse_support_ = std::move(support);
+}
+
+
+
+// 每个窗口换种子重试的次数
+static constexpr int RETRIES = 4;
+
+
+
+bool HierarchicalCollapse::generate()
+{
+    if (!solveCoarse_()) {
+        return false;
+    }
+    map_.fill(-1);
+
+    ThreadPool pool(threads_);
+    const Int2 blocks = getBlocks();
+    for (int parity = 0; parity < 2; ++parity) {
+        std::vector<Int2> todo;
+        for (const Int2 b : Int2::Range(blocks)) {
+            if ((b.y + b.x) % 2 == parity) todo.push_back(b);
+        }
+
+        // 同一轮的块互不相邻，可以并行求解
+        std::vector<char> ok(todo.size(), 0);
+        pool.parallelFor(todo.size(), [&](std::size_t i) {
+            const Int2 tl = todo[i] * block_;
+            const Int2 br(std::min(tl.y + block_, size_.y), std::min(tl.x + block_, size_.x));
+            for (int attempt = 0; attempt < RETRIES && !ok[i]; ++attempt) {
+                ok[i] = solveWindow_(tl, br, seedOf_(todo[i], attempt));
+            }
+        });
+
+        // 失败的块连同周围一圈的块一起重新求解
+        for (std::size_t i = 0; i < todo.size(); ++i) {
+            const Int2 tl(std::max(todo[i].y - 1, 0) * block_, std::max(todo[i].x - 1, 0) * block_);
+            const Int2 br(std::min((todo[i].y + 2) * block_, size_.y), std::min((todo[i].x + 2) * block_, size_.x));
+            for (int attempt = RETRIES; attempt < 3 * RETRIES && !ok[i]; ++attempt) {
+                ok[i] = solveWindow_(tl, br, seedOf_(todo[i], attempt), attempt >= 2 * RETRIES);
+            }
+            if (!ok[i]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+
+bool HierarchicalCollapse::solveCoarse_()
+{
+    const Int2 blocks = getBlocks();
+    const int n = static_cast<int>(classes_.size());
+    if (n == 0 || coarse_support_.size() != 4 * std::size_t(n)) {
+        return false;
+    }
+
+    std::minstd_rand gen(seed_);
+    WaveFunctionCollapse wfc(blocks.y, blocks.x, &gen);
+    auto& weights = wfc.getWeights();
+    weights.assign(n, 0);
+    for (int c = 0; c < n; ++c) {
+        for (int t = 0; t < static_cast<int>(weights_.size()); ++t) {
+            if (classes_[c] >> t & 1u) weights[c] += weights_[t];
+        }
+    }
+    wfc.setRule(dir4_list(), coarse_support_);
+    if (!wfc.init() || !wfc.generate()) {
+        return false;
+    }
+    coarse_ = Matrix<FactorType>(blocks.y, blocks.x);
+    for (const Int2 b : Int2::Range(blocks)) {
+        coarse_[b] = WaveFunctionCollapse::toFactor(wfc.get(b));
+    }
+    return true;
+}
+
+
+
+/*
+ * 求解 [tl, br) 中的格子，结果写入 map_
+ * 窗口向外扩展一格作为边界条件：已求解的格子固定为其结果，否则按所在块的元图块限制
+ * 扩展出的四个角与窗口内部不相邻，不读取，保证并行时不会读到其它线程正在写入的格子
+ * relax 为 true 时窗口内部不受元图块限制
+ */
+bool HierarchicalCollapse::solveWindow_(Int2 tl, Int2 br, std::uint32_t seed, bool relax)
+{
+    const Int2 wtl(std::max(tl.y - 1, 0), std::max(tl.x - 1, 0));
+    const Int2 wbr(std::min(br.y + 1, size_.y), std::min(br.x + 1, size_.x));
+
+    std::minstd_rand gen(seed);
+    WaveFunctionCollapse wfc(wbr.y - wtl.y, wbr.x - wtl.x, &gen);
+    wfc.getWeights() = weights_;
+    wfc.setRule(dir4_list(), support_);
+    if (!wfc.init()) {
+        return false;
+    }
+
+    const Int2::Range inner(tl, br);
+    std::vector<std::pair<Int2, BitsetType>> presets;
+    for (const Int2 pos : Int2::Range(wtl, wbr)) {
+        const bool row_in = tl.y <= pos.y && pos.y < br.y;
+        const bool col_in = tl.x <= pos.x && pos.x < br.x;
+        if (!row_in && !col_in) continue;
+        BitsetType mask = classMask_(pos);
+        if (inner.contains(pos)) {
+            if (relax) continue;
+        } else if (map_[pos] >= 0) {
+            mask = 1u << map_[pos];
+        }
+        presets.emplace_back(pos - wtl, mask);
+    }
+    if (!wfc.set(presets)) {
+        return false;
+    }
+
+    // 限制回溯的次数，避免在无解或难解的窗口上耗费过多时间，由调用者换一个种子或扩大窗口重试
+    if (!wfc.solveWithin()) {
+        return false;
+    }
+    for (const Int2 pos : inner) {
+        map_[pos] = WaveFunctionCollapse::toFactor(wfc.get(pos - wtl));
+    }
+    return true;
+}
+
+
+
+/*
+ * 格子所在块的元图块允许的细图块，块边缘 margin_ 以内的格子不受限制
+ */
+HierarchicalCollapse::BitsetType HierarchicalCollapse::classMask_(Int2 pos) const noexcept
+{
+    const Int2 b = pos / block_;
+    const Int2 tl = b * block_;
+    const Int2 br(std::min(tl.y + block_, size_.y), std::min(tl.x + block_, size_.x));
+    const int dist = std::min({pos.y - tl.y, pos.x - tl.x, br.y - 1 - pos.y, br.x - 1 - pos.x});
+    if (dist < margin_) {
+        return weights_.empty() ? 0u : ~0u >> (32 - weights_.size());
+    }
+    return classes_[coarse_[b]];
+}
+
+
+
+std::uint32_t HierarchicalCollapse::seedOf_(Int2 block, std::uint32_t salt) const noexcept
+{
+    const std::uint32_t id = static_cast<std::uint32_t>(block.y * getBlocks().x + block.x);
+    return seed_ ^ (id * 16u + salt + 1u) * 0x9e3779b9u;
+}
+
+
+
+} // namespace cha
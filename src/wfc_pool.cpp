@@ -0,0 +1,142 @@
+#include "wfc_pool.h"
+#include <algorithm>
+namespace cha
+{
+
+
+
+void SolverPool::Release::operator()(WaveFunctionCollapse* wfc) const
+{
+    if (pool) {
+        pool->release_(rule, size, settings, wfc);
+    } else {
+        delete wfc;
+    }
+}
+
+
+
+SolverPool::Settings SolverPool::Settings::of(const WaveFunctionCollapse& wfc)
+{
+    Settings res;
+    res.hash = wfc.getRuleHash();
+    res.heuristic = wfc.getHeuristic();
+    res.propagation = wfc.getPropagation();
+    res.lookahead = wfc.getLookahead();
+    res.restart_interval = wfc.getRestartInterval();
+    res.memory_budget = wfc.getMemoryBudget();
+    res.budget_action = wfc.getBudgetAction();
+    res.max_restarts = wfc.getMaxRestarts();
+    res.thread_pool = wfc.getThreadPool();
+    res.constraints = wfc.getConstraints();
+    return res;
+}
+
+
+
+void SolverPool::Settings::apply(WaveFunctionCollapse& wfc) const
+{
+    wfc.setHeuristic(heuristic);
+    wfc.setPropagation(propagation);
+    wfc.setLookahead(lookahead);
+    wfc.setRestartInterval(restart_interval);
+    wfc.setMemoryBudget(memory_budget, budget_action, max_restarts);
+    wfc.setThreadPool(thread_pool);
+    wfc.setConstraints(constraints);
+}
+
+
+
+int SolverPool::addRule(SetupType setup)
+{
+    std::lock_guard lock(mutex_);
+    setups_.push_back(std::move(setup));
+    return static_cast<int>(setups_.size()) - 1;
+}
+
+
+
+SolverPool::Lease SolverPool::acquire(int rule, Int3 size, std::uint32_t seed)
+{
+    std::unique_ptr<WaveFunctionCollapse> wfc;
+    SetupType setup;
+    {
+        std::lock_guard lock(mutex_);
+        if (rule < 0 || rule >= static_cast<int>(setups_.size())) {
+            return Lease(nullptr, Release{});
+        }
+        if (auto it = idle_.find(KeyType(rule, size)); it != idle_.end() && !it->second.solvers.empty()) {
+            wfc = std::move(it->second.solvers.back());
+            it->second.solvers.pop_back();
+            it->second.used = ++tick_;
+        } else {
+            setup = setups_[rule];
+        }
+    }
+
+    if (wfc) {
+        wfc->reset(seed);
+    } else {
+        // 缓存中没有时在锁外构造并初始化
+        wfc = std::make_unique<WaveFunctionCollapse>(size);
+        setup(*wfc);
+        if (!wfc->init()) {
+            return Lease(nullptr, Release{});
+        }
+        wfc->reset(seed);
+    }
+    const Settings settings = Settings::of(*wfc);
+    return Lease(wfc.release(), Release{this, rule, size, settings});
+}
+
+
+
+void SolverPool::release_(int rule, Int3 size, const Settings& settings, WaveFunctionCollapse* wfc)
+{
+    // 超出数量、被淘汰或规则被修改过的求解器在解锁之后销毁
+    std::unique_ptr<WaveFunctionCollapse> holder(wfc);
+    settings.apply(*wfc);
+    if (wfc->getRuleHash() != settings.hash) return;
+    IdleList evicted;
+    std::lock_guard lock(mutex_);
+    auto it = idle_.find(KeyType(rule, size));
+    if (it == idle_.end()) {
+        if (max_keys_ == 0) return;
+        if (idle_.size() >= max_keys_) {
+            auto oldest = std::min_element(idle_.begin(), idle_.end(), [](const auto& a, const auto& b) {
+                return a.second.used < b.second.used;
+            });
+            evicted = std::move(oldest->second);
+            idle_.erase(oldest);
+        }
+        it = idle_.emplace(KeyType(rule, size), IdleList{}).first;
+    }
+    it->second.used = ++tick_;
+    if (it->second.solvers.size() < max_idle_) {
+        it->second.solvers.push_back(std::move(holder));
+    }
+}
+
+
+
+std::size_t SolverPool::idle() const
+{
+    std::lock_guard lock(mutex_);
+    std::size_t res = 0;
+    for (const auto& [key, list] : idle_) {
+        res += list.solvers.size();
+    }
+    return res;
+}
+
+
+
+void SolverPool::clear()
+{
+    std::lock_guard lock(mutex_);
+    idle_.clear();
+}
+
+
+
+} // namespace cha
@@ -0,0 +1,297 @@
+#include "wfc_prefab.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <numeric>
+#include <optional>
+#include <random>
+#include "tools/fnv_hash.hpp"
+#include "tools/thread_pool.hpp"
+namespace cha
+{
+
+
+
+static std::vector<Int3> dir4_list()
+{
+    return std::vector<Int3>(std::begin(DIR4), std::end(DIR4));
+}
+
+
+
+PrefabLibrary::PrefabLibrary(int block, std::vector<BitsetType> support, std::vector<WeightType> weights)
+    : block_(std::max(block, 2)), support_(std::move(support)), weights_(std::move(weights)) {}
+
+
+
+/*
+ * 求解 size 大小的一块，presets 为预设，结果按行优先写入 tiles
+ * 限制回溯的次数，失败时由调用者换种子或放宽预设重试
+ */
+bool PrefabLibrary::solve_(const std::vector<std::pair<Int2, BitsetType>>& presets, Int2 size, std::uint32_t seed,
+                           std::vector<std::uint8_t>& tiles) const
+{
+    std::minstd_rand gen(seed);
+    WaveFunctionCollapse wfc(size.y, size.x, &gen);
+    wfc.getWeights() = weights_;
+    wfc.setRule(dir4_list(), support_);
+    wfc.setHeuristic(WaveFunctionCollapse::Heuristic::MRV);
+    if (!wfc.init() || !wfc.set(presets)) {
+        return false;
+    }
+    if (!wfc.solveWithin()) {
+        return false;
+    }
+    tiles.resize(std::size_t(size.y) * size.x);
+    for (const Int2 pos : Int2::Range(size)) {
+        tiles[std::size_t(pos.y) * size.x + pos.x] = static_cast<std::uint8_t>(WaveFunctionCollapse::toFactor(wfc.get(pos)));
+    }
+    return true;
+}
+
+
+
+std::uint64_t PrefabLibrary::keyOf_(std::uint64_t top, std::uint64_t left) noexcept
+{
+    return FnvHash().add(top).add(left).value();
+}
+
+
+
+/*
+ * 边的哈希值，edge 为 0 ~ 3 依次是上、左、右、下
+ * 上下两条边、左右两条边分别按同一方向读取，相邻两块共用的边哈希值相同
+ */
+std::uint64_t PrefabLibrary::edgeOf_(const std::vector<std::uint8_t>& tiles, int edge) const
+{
+    const int k = block_;
+    FnvHash hash;
+    hash.add(edge == 0 || edge == 3);
+    for (int i = 0; i < k; ++i) {
+        const Int2 pos = edge == 0 ? Int2(0, i) : edge == 1 ? Int2(i, 0) : edge == 2 ? Int2(i, k - 1) : Int2(k - 1, i);
+        hash.add(tiles[std::size_t(pos.y) * k + pos.x]);
+    }
+    return hash.value() | 1u;
+}
+
+
+
+void PrefabLibrary::add_(std::vector<std::uint8_t> tiles)
+{
+    Prefab prefab;
+    for (int e = 0; e < 4; ++e) {
+        prefab.edges[e] = edgeOf_(tiles, e);
+    }
+    prefab.tiles = std::move(tiles);
+    const int id = static_cast<int>(prefabs_.size());
+    const std::uint64_t top = prefab.edges[0];
+    const std::uint64_t left = prefab.edges[1];
+    for (const std::uint64_t key : {keyOf_(top, left), keyOf_(top, 0), keyOf_(0, left), keyOf_(0, 0)}) {
+        lookup_[key].push_back(id);
+    }
+    prefabs_.push_back(std::move(prefab));
+}
+
+
+
+bool PrefabLibrary::build(int colors, std::uint32_t seed, std::size_t threads)
+{
+    prefabs_.clear();
+    lookup_.clear();
+    const int k = block_;
+    const int count = static_cast<int>(weights_.size());
+    std::uint32_t salt = seed;
+    std::vector<std::uint8_t> tiles;
+
+    // 选定角图块：按权重从大到小尝试，四角都为该图块时可以求解即可
+    std::vector<int> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](int a, int b) { return weights_[a] > weights_[b]; });
+    int corner = -1;
+    for (int i = 0; i < count && corner < 0; ++i) {
+        const BitsetType mask = 1u << order[i];
+        const std::vector<std::pair<Int2, BitsetType>> presets{
+            {{0, 0}, mask}, {{0, k - 1}, mask}, {{k - 1, 0}, mask}, {{k - 1, k - 1}, mask}
+        };
+        for (int attempt = 0; attempt < 4 && corner < 0; ++attempt) {
+            if (solve_(presets, {k, k}, ++salt, tiles)) corner = order[i];
+        }
+    }
+    if (corner < 0) {
+        return false;
+    }
+
+    // 横向边与纵向边，两端均为角图块，去重
+    auto strips = [&](Int2 size) {
+        std::vector<std::vector<std::uint8_t>> res;
+        const std::vector<std::pair<Int2, BitsetType>> presets{{{0, 0}, 1u << corner}, {size - Int2(1, 1), 1u << corner}};
+        for (int attempt = 0; attempt < 8 * colors && res.size() < std::size_t(colors); ++attempt) {
+            if (solve_(presets, size, ++salt, tiles) && std::find(res.begin(), res.end(), tiles) == res.end()) {
+                res.push_back(tiles);
+            }
+        }
+        return res;
+    };
+    const auto rows = strips({1, k});
+    const auto cols = strips({k, 1});
+    if (rows.empty() || cols.empty()) {
+        return false;
+    }
+
+    // 对四条边的每种组合求解一块
+    const std::size_t nr = rows.size();
+    const std::size_t nc = cols.size();
+    const std::size_t total = nr * nc * nc * nr;
+    std::vector<std::optional<std::vector<std::uint8_t>>> results(total);
+    ThreadPool pool(threads);
+    pool.parallelFor(total, [&](std::size_t i) {
+        const auto& top = rows[i % nr];
+        const auto& left = cols[i / nr % nc];
+        const auto& right = cols[i / nr / nc % nc];
+        const auto& bottom = rows[i / nr / nc / nc];
+        std::vector<std::pair<Int2, BitsetType>> presets;
+        for (int j = 0; j < k; ++j) {
+            presets.emplace_back(Int2(0, j), 1u << top[j]);
+            presets.emplace_back(Int2(j, 0), 1u << left[j]);
+            presets.emplace_back(Int2(j, k - 1), 1u << right[j]);
+            presets.emplace_back(Int2(k - 1, j), 1u << bottom[j]);
+        }
+        std::vector<std::uint8_t> block;
+        for (int attempt = 0; attempt < 4; ++attempt) {
+            if (solve_(presets, {k, k}, seed ^ static_cast<std::uint32_t>((i * 4 + attempt + 1) * 0x9e3779b9u), block)) {
+                results[i] = std::move(block);
+                break;
+            }
+        }
+    });
+    for (auto& block : results) {
+        if (block) add_(std::move(*block));
+    }
+    return !prefabs_.empty();
+}
+
+
+
+bool PrefabLibrary::assemble(Int2 size, std::uint32_t seed, Matrix<FactorType>& out)
+{
+    fallbacks_ = 0;
+    if (prefabs_.empty() || size.y <= 0 || size.x <= 0) {
+        return false;
+    }
+    const int k = block_;
+    const int stride = k - 1;
+    const Int2 blocks(std::max(1, (size.y - 1 + stride - 1) / stride), std::max(1, (size.x - 1 + stride - 1) / stride));
+    out = Matrix<FactorType>(size.y, size.x, -1);
+
+    std::minstd_rand gen(seed);
+    std::vector<int> chosen(std::size_t(blocks.y) * blocks.x, -1);
+    std::vector<std::uint8_t> tiles;
+    for (const Int2 b : Int2::Range(blocks)) {
+        const int above = b.y > 0 ? chosen[std::size_t(b.y - 1) * blocks.x + b.x] : -1;
+        const int before = b.x > 0 ? chosen[std::size_t(b.y) * blocks.x + b.x - 1] : -1;
+        const std::uint64_t top = above >= 0 ? prefabs_[above].edges[3] : 0;
+        const std::uint64_t left = before >= 0 ? prefabs_[before].edges[2] : 0;
+
+        int id = -1;
+        if (const auto it = lookup_.find(keyOf_(top, left)); it != lookup_.end()) {
+            std::uniform_int_distribution<std::size_t> dist(0, it->second.size() - 1);
+            id = it->second[dist(gen)];
+        } else {
+            // 以邻居的边为预设就地求解，先让另外两条边也取库中已有的边，失败后再放开
+            ++fallbacks_;
+            for (int attempt = 0; attempt < 8 && id < 0; ++attempt) {
+                std::vector<std::pair<Int2, BitsetType>> presets;
+                std::uniform_int_distribution<std::size_t> dist(0, prefabs_.size() - 1);
+                const auto& bottom = prefabs_[dist(gen)].tiles;
+                const auto& right = prefabs_[dist(gen)].tiles;
+                for (int j = 0; j < k; ++j) {
+                    if (above >= 0) presets.emplace_back(Int2(0, j), 1u << prefabs_[above].tiles[std::size_t(k - 1) * k + j]);
+                    if (before >= 0) presets.emplace_back(Int2(j, 0), 1u << prefabs_[before].tiles[std::size_t(j) * k + k - 1]);
+                    if (attempt < 4 && j > 0) {
+                        presets.emplace_back(Int2(k - 1, j), 1u << bottom[std::size_t(k - 1) * k + j]);
+                        presets.emplace_back(Int2(j, k - 1), 1u << right[std::size_t(j) * k + k - 1]);
+                    }
+                }
+                if (solve_(presets, {k, k}, static_cast<std::uint32_t>(gen()), tiles)) {
+                    id = static_cast<int>(prefabs_.size());
+                    add_(tiles);
+                }
+            }
+            if (id < 0) {
+                return false;
+            }
+        }
+        chosen[std::size_t(b.y) * blocks.x + b.x] = id;
+
+        const Int2 origin = b * stride;
+        const auto& src = prefabs_[id].tiles;
+        for (int y = 0; y < k && origin.y + y < size.y; ++y) {
+            for (int x = 0; x < k && origin.x + x < size.x; ++x) {
+                out[Int2(origin.y + y, origin.x + x)] = src[std::size_t(y) * k + x];
+            }
+        }
+    }
+    return true;
+}
+
+
+
+/*
+ * 文件格式：magic, 块的边长, 图块数量, 块的数量（均为 uint32），之后为逐块逐行排列的图块
+ */
+static constexpr char PREFAB_MAGIC[4] = {'W', 'F', 'C', 'P'};
+
+bool PrefabLibrary::save(const std::string& path) const
+{
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    const std::uint32_t header[3] = {
+        static_cast<std::uint32_t>(block_),
+        static_cast<std::uint32_t>(weights_.size()),
+        static_cast<std::uint32_t>(prefabs_.size()),
+    };
+    bool ok = std::fwrite(PREFAB_MAGIC, sizeof(PREFAB_MAGIC), 1, file) == 1
+        && std::fwrite(header, sizeof(header), 1, file) == 1;
+    for (const Prefab& prefab : prefabs_) {
+        ok = ok && std::fwrite(prefab.tiles.data(), 1, prefab.tiles.size(), file) == prefab.tiles.size();
+    }
+    return std::fclose(file) == 0 && ok;
+}
+
+
+
+bool PrefabLibrary::load(const std::string& path)
+{
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+    char magic[4];
+    std::uint32_t header[3];
+    bool ok = std::fread(magic, sizeof(magic), 1, file) == 1 && std::memcmp(magic, PREFAB_MAGIC, sizeof(magic)) == 0
+        && std::fread(header, sizeof(header), 1, file) == 1
+        && header[0] == std::uint32_t(block_) && header[1] == weights_.size();
+    std::vector<std::vector<std::uint8_t>> blocks;
+    for (std::uint32_t i = 0; ok && i < header[2]; ++i) {
+        std::vector<std::uint8_t> tiles(std::size_t(block_) * block_);
+        ok = std::fread(tiles.data(), 1, tiles.size(), file) == tiles.size()
+            && std::all_of(tiles.begin(), tiles.end(), [this](std::uint8_t t) { return t < weights_.size(); });
+        blocks.push_back(std::move(tiles));
+    }
+    std::fclose(file);
+    if (!ok) {
+        return false;
+    }
+    prefabs_.clear();
+    lookup_.clear();
+    for (auto& tiles : blocks) {
+        add_(std::move(tiles));
+    }
+    return true;
+}
+
+
+
+} // namespace cha
@@ -0,0 +1,216 @@
+#include "wfc_service.h"
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <exception>
+#include <istream>
+#include <mutex>
+#include <ostream>
+#include "tools/thread_pool.hpp"
+namespace cha
+{
+
+
+
+void GenerationService::addRule(std::string name, SolverPool::SetupType setup)
+{
+    // 缓存的键另外包含尺寸，这里的尺寸不影响结果
+    WaveFunctionCollapse probe(Int3(1, 1, 1));
+    setup(probe);
+    const std::uint64_t hash = probe.getRuleHash();
+    rules_[std::move(name)] = RuleEntry{pool_.addRule(std::move(setup)), hash};
+}
+
+
+
+/*
+ * 取出下一个以空白分隔的词，没有时返回空
+ */
+static std::string_view next_token(std::string_view& line)
+{
+    const std::size_t begin = line.find_first_not_of(" \t\r");
+    if (begin == std::string_view::npos) {
+        line = {};
+        return {};
+    }
+    const std::size_t end = std::min(line.find_first_of(" \t\r", begin), line.size());
+    const std::string_view res = line.substr(begin, end - begin);
+    line.remove_prefix(end);
+    return res;
+}
+
+
+
+template <typename T>
+static bool next_number(std::string_view& line, T& value)
+{
+    const std::string_view token = next_token(line);
+    const auto [ptr, ec] = std::from_chars(token.data(), token.data() + token.size(), value);
+    return !token.empty() && ec == std::errc() && ptr == token.data() + token.size();
+}
+
+
+
+bool GenerationService::parse(std::string_view line, Request& request)
+{
+    request = Request{};
+    if (!next_number(line, request.id)) {
+        return false;
+    }
+    request.rule = next_token(line);
+    if (request.rule.empty()
+        || !next_number(line, request.size.y) || !next_number(line, request.size.x)
+        || !next_number(line, request.seed)) {
+        return false;
+    }
+    while (true) {
+        Int2 pos;
+        BitsetType mask;
+        if (!next_number(line, pos.y)) break;
+        if (!next_number(line, pos.x) || !next_number(line, mask)) {
+            return false;
+        }
+        request.presets.emplace_back(pos, mask);
+    }
+    return next_token(line).empty();
+}
+
+
+
+GenerationService::Response GenerationService::handle(const Request& request)
+{
+    Response res;
+    res.id = request.id;
+    res.size = request.size;
+    const auto it = rules_.find(request.rule);
+    if (it == rules_.end() || request.size.y <= 0 || request.size.x <= 0
+        || std::size_t(request.size.y) * std::size_t(request.size.x) > max_cells_) {
+        return res;
+    }
+    for (const auto& [pos, mask] : request.presets) {
+        if (pos.y < 0 || pos.y >= request.size.y || pos.x < 0 || pos.x >= request.size.x) {
+            return res;
+        }
+    }
+    // 先查缓存，命中时不必取出并重置求解器；规则哈希为 0 时不使用缓存
+    const std::uint64_t rule_hash = cache_ ? it->second.hash : 0;
+    if (const auto entry = rule_hash ? cache_->find(rule_hash, request.size, request.seed, request.presets) : MapCache::Entry{}) {
+        res.status = Status::Ok;
+        res.size = entry.size;
+        res.tiles.assign(entry.tiles.begin(), entry.tiles.end());
+        return res;
+    }
+
+    const auto wfc = pool_.acquire(it->second.id, request.size, request.seed);
+    if (!wfc) {
+        return res;
+    }
+
+    if (!wfc->set(request.presets)) {
+        res.status = Status::Contradiction;
+        return res;
+    }
+    // 限制回溯的次数，避免难解的请求长期占用工作线程
+    if (!wfc->solveWithin()) {
+        res.status = Status::Failed;
+        return res;
+    }
+
+    res.status = Status::Ok;
+    res.tiles.resize(std::size_t(request.size.y) * request.size.x);
+    for (const Int2 pos : Int2::Range(request.size)) {
+        const int factor = WaveFunctionCollapse::toFactor(wfc->get(pos));
+        res.tiles[std::size_t(pos.y) * request.size.x + pos.x] = factor < 0 ? 255 : static_cast<std::uint8_t>(factor);
+    }
+    if (rule_hash) {
+        cache_->insert(rule_hash, res.size, request.seed, request.presets, res.tiles);
+    }
+    return res;
+}
+
+
+
+void GenerationService::write(std::ostream& out, const Response& response)
+{
+    const bool ok = response.status == Status::Ok;
+    const std::uint32_t header[4] = {
+        response.id,
+        static_cast<std::uint32_t>(response.status),
+        static_cast<std::uint32_t>(response.size.y),
+        static_cast<std::uint32_t>(response.size.x),
+    };
+    char bytes[sizeof(header)];
+    for (int i = 0; i < 4; ++i) {
+        for (int b = 0; b < 4; ++b) {
+            bytes[i * 4 + b] = static_cast<char>(header[i] >> (8 * b) & 0xffu);
+        }
+    }
+    out.write(bytes, sizeof(bytes));
+    if (ok) {
+        out.write(reinterpret_cast<const char*>(response.tiles.data()), std::streamsize(response.tiles.size()));
+    }
+}
+
+
+
+void GenerationService::run(std::istream& in, std::ostream& out)
+{
+    std::mutex out_mutex;
+    auto reply = [&](const Response& response) {
+        std::lock_guard lock(out_mutex);
+        write(out, response);
+        out.flush();
+    };
+
+    // 同时求解的请求数量，达到上限时读取线程等待，避免请求无限地积压在任务队列中
+    std::mutex pending_mutex;
+    std::condition_variable pending_cv;
+    std::size_t pending = 0;
+
+    // 读取时不再刷新 out（例如 std::cin 与 std::cout），out 只在持有锁时访问
+    std::ostream* const tied = in.tie(nullptr);
+    {
+        ThreadPool workers(threads_);
+        const std::size_t limit = max_pending_ ? max_pending_ : 4 * workers.size();
+        for (std::string line; std::getline(in, line);) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            Request request;
+            if (!parse(line, request)) {
+                Response res;
+                res.id = request.id;
+                res.size = request.size;
+                reply(res);
+                continue;
+            }
+            {
+                std::unique_lock lock(pending_mutex);
+                pending_cv.wait(lock, [&] { return pending < limit; });
+                ++pending;
+            }
+            // 异常不能离开工作线程，分配失败等错误作为求解失败返回
+            workers.submit([this, request = std::move(request), &reply, &pending_mutex, &pending_cv, &pending] {
+                Response res;
+                try {
+                    res = handle(request);
+                } catch (const std::exception&) {
+                    res = Response();
+                    res.id = request.id;
+                    res.size = request.size;
+                    res.status = Status::Failed;
+                }
+                reply(res);
+                {
+                    std::lock_guard lock(pending_mutex);
+                    --pending;
+                }
+                pending_cv.notify_one();
+            });
+        }
+        // 析构时等待所有请求完成
+    }
+    in.tie(tied);
+}
+
+
+
+} // namespace cha
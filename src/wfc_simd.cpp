@@ -0,0 +1,177 @@
+#include "wfc_simd.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHA_SIMD_X86 1
+#endif
+namespace cha::simd
+{
+
+
+
+using NarrowFunc = std::size_t (*)(std::uint32_t*, const std::uint32_t*, std::size_t,
+                                   const std::uint32_t*, int, int*, std::uint32_t*);
+
+
+
+static inline std::uint32_t valid_of(std::uint32_t bitset, const std::uint32_t* support, int count) noexcept
+{
+    std::uint32_t res = 0u;
+    for (int t = 0; t < count; ++t) {
+        res |= -(bitset >> t & 1u) & support[t];
+    }
+    return res;
+}
+
+
+
+static std::size_t narrow_scalar(std::uint32_t* dst, const std::uint32_t* src, std::size_t n,
+                                 const std::uint32_t* support, int count,
+                                 int* changed, std::uint32_t* old) noexcept
+{
+    std::size_t m = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+        const std::uint32_t tmp = dst[i];
+        const std::uint32_t res = tmp & valid_of(src[i], support, count);
+        if (res != tmp) {
+            dst[i] = res;
+            changed[m] = static_cast<int>(i);
+            old[m++] = tmp;
+        }
+    }
+    return m;
+}
+
+
+
+#ifdef CHA_SIMD_X86
+
+__attribute__((target("avx2")))
+static std::size_t narrow_avx2(std::uint32_t* dst, const std::uint32_t* src, std::size_t n,
+                               const std::uint32_t* support, int count,
+                               int* changed, std::uint32_t* old) noexcept
+{
+    __m256i bits[32], sups[32];
+    for (int t = 0; t < count; ++t) {
+        bits[t] = _mm256_set1_epi32(static_cast<int>(1u << t));
+        sups[t] = _mm256_set1_epi32(static_cast<int>(support[t]));
+    }
+
+    std::size_t i = 0, m = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i acc = _mm256_setzero_si256();
+        for (int t = 0; t < count; ++t) {
+            // 第 t 位为 1 的通道取全 1，再与该图块的邻居集合相与
+            const __m256i sel = _mm256_cmpeq_epi32(_mm256_and_si256(s, bits[t]), bits[t]);
+            acc = _mm256_or_si256(acc, _mm256_and_si256(sel, sups[t]));
+        }
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        const __m256i r = _mm256_and_si256(d, acc);
+        unsigned diff = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(d, r))) & 0xffu;
+        if (diff) [[unlikely]] {
+            alignas(32) std::uint32_t tmp[8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(tmp), d);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), r);
+            for (; diff; diff &= diff - 1) {
+                const int lane = __builtin_ctz(diff);
+                changed[m] = static_cast<int>(i) + lane;
+                old[m++] = tmp[lane];
+            }
+        }
+    }
+    if (i < n) {
+        const std::size_t k = narrow_scalar(dst + i, src + i, n - i, support, count, changed + m, old + m);
+        for (std::size_t j = m; j < m + k; ++j) changed[j] += static_cast<int>(i);
+        m += k;
+    }
+    return m;
+}
+
+
+
+__attribute__((target("avx512f")))
+static std::size_t narrow_avx512(std::uint32_t* dst, const std::uint32_t* src, std::size_t n,
+                                 const std::uint32_t* support, int count,
+                                 int* changed, std::uint32_t* old) noexcept
+{
+    std::size_t i = 0, m = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512i s = _mm512_loadu_si512(src + i);
+        __m512i acc = _mm512_setzero_si512();
+        for (int t = 0; t < count; ++t) {
+            const __mmask16 sel = _mm512_test_epi32_mask(s, _mm512_set1_epi32(static_cast<int>(1u << t)));
+            acc = _mm512_mask_or_epi32(acc, sel, acc, _mm512_set1_epi32(static_cast<int>(support[t])));
+        }
+        const __m512i d = _mm512_loadu_si512(dst + i);
+        const __m512i r = _mm512_and_si512(d, acc);
+        unsigned diff = _mm512_cmpneq_epi32_mask(d, r);
+        if (diff) [[unlikely]] {
+            alignas(64) std::uint32_t tmp[16];
+            _mm512_store_si512(tmp, d);
+            _mm512_storeu_si512(dst + i, r);
+            for (; diff; diff &= diff - 1) {
+                const int lane = __builtin_ctz(diff);
+                changed[m] = static_cast<int>(i) + lane;
+                old[m++] = tmp[lane];
+            }
+        }
+    }
+    if (i < n) {
+        const std::size_t k = narrow_avx2(dst + i, src + i, n - i, support, count, changed + m, old + m);
+        for (std::size_t j = m; j < m + k; ++j) changed[j] += static_cast<int>(i);
+        m += k;
+    }
+    return m;
+}
+
+#endif
+
+
+
+static NarrowFunc select_narrow(const char** name) noexcept
+{
+#ifdef CHA_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        *name = "avx512";
+        return narrow_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return narrow_avx2;
+    }
+#endif
+    *name = "scalar";
+    return narrow_scalar;
+}
+
+
+
+static const char* isa_name = "scalar";
+
+static NarrowFunc narrow_impl() noexcept
+{
+    static const NarrowFunc func = select_narrow(&isa_name);
+    return func;
+}
+
+
+
+std::size_t narrow(std::uint32_t* dst, const std::uint32_t* src, std::size_t n,
+                   const std::uint32_t* support, int count,
+                   int* changed, std::uint32_t* old) noexcept
+{
+    return narrow_impl()(dst, src, n, support, count, changed, old);
+}
+
+
+
+const char* isa() noexcept
+{
+    narrow_impl();
+    return isa_name;
+}
+
+
+
+} // namespace cha::simd
@@ -0,0 +1,102 @@
+#include "wfc_stream.h"
+#include <algorithm>
+#include <random>
+namespace cha
+{
+
+
+
+StripStream::StripStream(int width, std::vector<BitsetType> support, std::vector<WeightType> weights, std::uint32_t seed)
+    : width_(width), seed_(seed), support_(std::move(support)), weights_(std::move(weights)) {}
+
+
+
+/*
+ * 所有窗口共用一个求解器，每个窗口以 reset() 重新开始，不再分配内存
+ * 第一个窗口从第 0 行开始输出；之后的窗口第 0 行固定为上一次输出的最后一行，从第 1 行开始输出
+ */
+bool StripStream::generate(const SinkType& sink, std::int64_t rows)
+{
+    rows_ = 0;
+    retried_ = 0;
+    // 之后的窗口从第 1 行开始输出 commit_ 行，窗口至少要有 commit_ + 1 行
+    if (commit_ < 1 || commit_ >= window_ || width_ <= 0) {
+        return false;
+    }
+    if (rows <= 0) {
+        return true;
+    }
+
+    std::minstd_rand gen(seed_);
+    WaveFunctionCollapse wfc(window_, width_, &gen);
+    wfc.getWeights() = weights_;
+    wfc.setRule(std::vector<Int3>(std::begin(DIR4), std::end(DIR4)), support_);
+    wfc.setHeuristic(WaveFunctionCollapse::Heuristic::Scanline);
+    if (!wfc.init()) {
+        return false;
+    }
+
+    std::vector<FactorType> row(width_);
+    std::vector<std::pair<Int2, BitsetType>> presets(width_);
+    for (std::int64_t strip = 0; rows_ < rows; ++strip) {
+        const int first = strip == 0 ? 0 : 1;
+        bool ok = false;
+        for (int attempt = 0; attempt < retries_ && !ok; ++attempt) {
+            if (attempt > 0) ++retried_;
+            wfc.reset(seedOf_(strip, attempt));
+            // 限制每个窗口回溯的次数，难解时换一个种子重试
+            ok = (first == 0 || wfc.set(presets)) && wfc.solveWithin();
+        }
+        if (!ok) {
+            return false;
+        }
+
+        const int count = static_cast<int>(std::min<std::int64_t>(commit_, rows - rows_));
+        for (int y = first; y < first + count; ++y) {
+            for (int x = 0; x < width_; ++x) {
+                row[x] = WaveFunctionCollapse::toFactor(wfc.get(Int2(y, x)));
+            }
+            if (!sink(rows_++, row)) {
+                return true;
+            }
+        }
+        for (int x = 0; x < width_; ++x) {
+            presets[x] = {Int2(0, x), 1u << row[x]};
+        }
+    }
+    return true;
+}
+
+
+
+bool StripStream::generate(MappedMatrix<std::uint8_t>& out)
+{
+    if (!out.isWritable() || out.cols() != std::size_t(width_)) {
+        return false;
+    }
+    constexpr std::size_t TILE = MappedMatrix<std::uint8_t>::TILE;
+    out.advise(MappedMatrix<std::uint8_t>::Access::Sequential);
+    const bool ok = generate([&out](std::int64_t row, std::span<const FactorType> tiles) {
+        const std::size_t y = static_cast<std::size_t>(row);
+        for (std::size_t x = 0; x < tiles.size(); ++x) {
+            out(y, x) = static_cast<std::uint8_t>(tiles[x]);
+        }
+        if ((y + 1) % TILE == 0) {
+            out.release(y + 1 - TILE, y + 1);
+        }
+        return true;
+    }, static_cast<std::int64_t>(out.rows()));
+    out.release(0, out.rows());
+    return ok;
+}
+
+
+
+std::uint32_t StripStream::seedOf_(std::int64_t strip, std::uint32_t salt) const noexcept
+{
+    return seed_ ^ (static_cast<std::uint32_t>(strip) * 16u + salt + 1u) * 0x9e3779b9u;
+}
+
+
+
+} // namespace cha
@@ -0,0 +1,133 @@
+#include "wfc_topology.h"
+#include <algorithm>
+#include <cstdlib>
+#include "tools/matrix3.hpp"
+namespace cha
+{
+
+
+
+/*
+ * 对每一行、每种列预先求出各方向上邻居相对本格的偏移，列的种类见 visit()
+ * 同一种列的格子越过左右边界的情况相同，环面上回绕之后的偏移也相同
+ * 行号借用 Matrix3 的分块排列，使相邻格子的编号也相近
+ */
+Topology Topology::lattice(Int3 size, std::span<const Int3> dirs, bool wrap)
+{
+    Topology res;
+    res.size_ = size;
+    res.dirs_.assign(dirs.begin(), dirs.end());
+    res.label_count_ = static_cast<int>(dirs.size());
+    res.lattice_ = true;
+
+    // 左右各 edge 列单独成一种，中间的列为一种；列数不足时每一列各为一种
+    const int count = static_cast<int>(dirs.size());
+    const int cols = size.x;
+    int edge = 0;
+    for (const Int3 dp : dirs) {
+        edge = std::max(edge, std::abs(dp.x));
+    }
+    if (cols < 2 * edge + 1) {
+        edge = cols;
+    }
+    res.col_edge_ = edge;
+    res.col_kinds_ = edge == cols ? cols : 2 * edge + 1;
+
+    const Matrix3<std::uint8_t> layout(Int3(size.z, size.y, 1));
+    const int rows = size.z * size.y;
+    res.row_delta_.assign(std::size_t(rows) * res.col_kinds_ * count, NONE);
+    for (int r = 0; r < rows; ++r) {
+        const Int3 pos = layout.coord(r);
+        for (int kind = 0; kind < res.col_kinds_; ++kind) {
+            // 这种列中的任意一列
+            const int x = kind <= edge ? kind : kind + cols - 2 * edge - 1;
+            for (int d = 0; d < count; ++d) {
+                int tz = pos.z + dirs[d].z;
+                int ty = pos.y + dirs[d].y;
+                int tx = x + dirs[d].x;
+                if (wrap) {
+                    tz = (tz % size.z + size.z) % size.z;
+                    ty = (ty % size.y + size.y) % size.y;
+                    tx = (tx % cols + cols) % cols;
+                } else if (tz < 0 || tz >= size.z || ty < 0 || ty >= size.y || tx < 0 || tx >= cols) {
+                    continue;
+                }
+                const int tr = static_cast<int>(layout.index(Int3(tz, ty, 0)));
+                res.row_delta_[(std::size_t(r) * res.col_kinds_ + kind) * count + d] = (tr - r) * cols + tx - x;
+            }
+        }
+    }
+    return res;
+}
+
+
+
+Topology Topology::grid(Int3 size, std::span<const Int3> dirs)
+{
+    Topology res = lattice(size, dirs, false);
+    res.grid_ = true;
+    return res;
+}
+
+
+
+Topology Topology::wrap(Int3 size, std::span<const Int3> dirs)
+{
+    return lattice(size, dirs, true);
+}
+
+
+
+Topology Topology::grid(Int3 size, std::span<const Int2> dirs)
+{
+    const std::vector<Int3> tmp(dirs.begin(), dirs.end());
+    return grid(size, tmp);
+}
+
+
+
+Topology Topology::wrap(Int3 size, std::span<const Int2> dirs)
+{
+    const std::vector<Int3> tmp(dirs.begin(), dirs.end());
+    return wrap(size, tmp);
+}
+
+
+
+Topology Topology::hex(int rows, int cols)
+{
+    return lattice(Int3(1, rows, cols), HEX6, false);
+}
+
+
+
+Topology Topology::graph(int count, std::span<const Link> links, std::vector<Int3> dirs)
+{
+    Topology res;
+    res.size_ = Int3(1, 1, count);
+    res.label_count_ = static_cast<int>(dirs.size());
+    res.dirs_ = std::move(dirs);
+
+    // 计数排序，按起点分组
+    res.offsets_.assign(count + 1, 0);
+    for (const Link& link : links) {
+        ++res.offsets_[link.from + 1];
+        res.label_count_ = std::max(res.label_count_, link.label + 1);
+    }
+    for (int i = 0; i < count; ++i) {
+        res.offsets_[i + 1] += res.offsets_[i];
+    }
+    res.targets_.resize(links.size());
+    res.labels_.resize(links.size());
+    std::vector<int> cursor(res.offsets_.begin(), res.offsets_.end() - 1);
+    for (const Link& link : links) {
+        const int e = cursor[link.from]++;
+        res.targets_[e] = link.to;
+        res.labels_[e] = link.label;
+    }
+    return res;
+}
+
+
+
+} // namespace cha
@@ -0,0 +1,80 @@
+#include <cstdio>
+#include <cstdlib>
+#include "wfc.h"
+#include "wfc_rule.hpp"
+#include "tools/thread_pool.hpp"
+// 替换全局的 operator new 统计分配次数，只在这个测试程序中使用
+#define CHA_ALLOC_COUNTER
+#include "tools/alloc_counter.hpp"
+
+// 完整的管道图块：拐角、直线、丁字、十字与空白
+inline constexpr std::array PIPE_FULL_TILES{
+    cha::TileRule{{0, 0, 1, 1}, cha::Symmetry::L, 2},
+    cha::TileRule{{1, 0, 0, 1}, cha::Symmetry::I, 2},
+    cha::TileRule{{1, 1, 1, 0}, cha::Symmetry::T},
+    cha::TileRule{{1, 1, 1, 1}},
+    cha::TileRule{{0, 0, 0, 0}, cha::Symmetry::X, 4},
+};
+constexpr auto PIPE_FULL_RULE = cha::compileRule<PIPE_FULL_TILES>();
+
+
+
+/*
+ * 检查复用的求解器在 generate() 中不再分配堆内存
+ * 先以若干种子求解，使决定栈、撤销记录与各处的辅助内存增长到所需的大小，
+ * 再以另外的种子 reset() 之后求解，分配次数应为 0。计数只针对调用线程，线程池中的分配不计入
+ */
+static bool check(cha::WaveFunctionCollapse::Heuristic heuristic, cha::WaveFunctionCollapse::Propagation propagation,
+                  int lookahead, cha::ThreadPool& pool)
+{
+    cha::WaveFunctionCollapse wfc(32, 32);
+    wfc.setRule(PIPE_FULL_RULE);
+    wfc.setHeuristic(heuristic);
+    wfc.setPropagation(propagation);
+    wfc.setThreadPool(&pool);
+    wfc.setLookahead(lookahead);
+    if (!wfc.init()) {
+        std::printf("heuristic %d propagation %d lookahead %d: init failed\n", int(heuristic), int(propagation), lookahead);
+        return false;
+    }
+    bool ok = true;
+    for (std::uint32_t seed = 0; seed < 8; ++seed) {
+        wfc.reset(seed);
+        if (!wfc.generate()) {
+            std::printf("heuristic %d propagation %d lookahead %d seed %u: warm-up failed\n",
+                        int(heuristic), int(propagation), lookahead, seed);
+            ok = false;
+        }
+    }
+    for (std::uint32_t seed = 100; seed < 104; ++seed) {
+        wfc.reset(seed);
+        const cha::AllocCounter allocs;
+        const bool done = wfc.generate();
+        const std::size_t count = allocs.get();
+        if (!done || count != 0) {
+            std::printf("heuristic %d propagation %d lookahead %d seed %u: generate %d, %zu allocations\n",
+                        int(heuristic), int(propagation), lookahead, seed, int(done), count);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+
+int main()
+{
+    using Heuristic = cha::WaveFunctionCollapse::Heuristic;
+    using Propagation = cha::WaveFunctionCollapse::Propagation;
+    cha::ThreadPool pool(4);
+    bool ok = true;
+    for (const Heuristic heuristic : {Heuristic::Entropy, Heuristic::MRV, Heuristic::Scanline, Heuristic::Hilbert, Heuristic::Spiral}) {
+        for (const Propagation propagation : {Propagation::Queue, Propagation::Sweep, Propagation::Parallel}) {
+            for (const int lookahead : {0, 3}) {
+                ok = check(heuristic, propagation, lookahead, pool) && ok;
+            }
+        }
+    }
+    std::printf(ok ? "alloc_test passed\n" : "alloc_test failed\n");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -19,11 +19,71 @@ target("main")
     add_files(
         "src/main.cpp",
         "src/renderer.cpp",
-        "src/wfc.cpp"
+        "src/wfc.cpp",
+        "src/wfc_batch.cpp",
+        "src/wfc_global.cpp",
+        "src/wfc_hier.cpp",
+        "src/wfc_pool.cpp",
+        "src/wfc_prefab.cpp",
+        "src/wfc_simd.cpp",
+        "src/wfc_stream.cpp",
+        "src/wfc_topology.cpp"
     )
     after_build(
         function (target)
             os.cp("assets", target:targetdir())
         end
     )
-target_end()
\ No newline at end of file
+target_end()
+
+
+target("service")
+    set_kind("binary")
+    add_packages("fmt")
+    add_cxxflags("-O2")
+    add_includedirs("include")
+    add_files(
+        "src/service.cpp",
+        "src/wfc_cache.cpp",
+        "src/wfc.cpp",
+        "src/wfc_global.cpp",
+        "src/wfc_pool.cpp",
+        "src/wfc_service.cpp",
+        "src/wfc_simd.cpp",
+        "src/wfc_topology.cpp"
+    )
+target_end()
+
+
+target("alloc_test")
+    set_kind("binary")
+    set_default(false)
+    add_packages("fmt")
+    add_cxxflags("-O2")
+    add_includedirs("include")
+    add_files(
+        "tests/alloc_test.cpp",
+        "src/wfc.cpp",
+        "src/wfc_global.cpp",
+        "src/wfc_simd.cpp",
+        "src/wfc_topology.cpp"
+    )
+    add_tests("default")
+target_end()
+
+
+target("replay_test")
+    set_kind("binary")
+    set_default(false)
+    add_packages("fmt")
+    add_cxxflags("-O2")
+    add_includedirs("include")
+    add_files(
+        "tests/replay_test.cpp",
+        "src/wfc.cpp",
+        "src/wfc_global.cpp",
+        "src/wfc_simd.cpp",
+        "src/wfc_topology.cpp"
+    )
+    add_tests("default")
+target_end()